@@ -0,0 +1,49 @@
+/***************************************************************************
+    begin                : October 16, 2026
+    copyright            : (C) 2026 by Boundless Spatial, Inc. USA
+    author               : Larry Shaffer
+    email                : lshaffer at boundlessgeo dot com
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+// Compiles a directory of defined OAuth2 configs into a bundle file, e.g. when packaging
+// the configs installed to QgsAuthOAuth2Config::oauth2ConfigsPkgDataDir()
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+
+#include "qgsauthoauth2configbundle.h"
+
+
+int main( int argc, char *argv[] )
+{
+  QCoreApplication app( argc, argv );
+  QTextStream err( stderr );
+
+  QStringList args( app.arguments() );
+  if ( args.size() < 2 || args.size() > 3 )
+  {
+    err << QStringLiteral( "Usage: oauth2bundletool <configs directory> [bundle file]\n"
+                           "Default bundle file: <configs directory>/%1\n" )
+        .arg( QgsAuthOAuth2ConfigBundle::bundleFileName() );
+    return 2;
+  }
+
+  QString error;
+  if ( !QgsAuthOAuth2ConfigBundle::compileDirectory( args.at( 1 ),
+       args.size() > 2 ? args.at( 2 ) : QString(),
+       QgsAuthOAuth2Config::JSON,
+       &error ) )
+  {
+    err << error << "\n";
+    return 1;
+  }
+  return 0;
+}
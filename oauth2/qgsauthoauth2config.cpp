@@ -13,9 +13,21 @@
  ***************************************************************************/
 
 #include "qgsauthoauth2config.h"
+#include "qgsauthoauth2configbundle.h"
 
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
 #include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QScopedPointer>
+#include <QSet>
 #include <QSettings>
+#include <QSharedPointer>
+#include <QtConcurrentMap>
 
 #include "qjsonwrapper/Json.h"
 
@@ -23,17 +35,133 @@
 #include "qgslogger.h"
 
 
+// Values shared between QgsAuthOAuth2ConfigData copies and the QgsAuthOAuth2Config wrapping them
+class QgsAuthOAuth2ConfigDataPrivate : public QSharedData
+{
+  public:
+    QgsAuthOAuth2ConfigDataPrivate()
+      : mVersion( 1 )
+      , mConfigType( QgsAuthOAuth2Config::Custom )
+      , mGrantFlow( QgsAuthOAuth2Config::AuthCode )
+      , mRedirectPort( 7070 )
+      , mPersistToken( false )
+      , mAccessMethod( QgsAuthOAuth2Config::Header )
+      , mRequestTimeout( 30 ) // in seconds
+      , mRefreshLeadTime( 300 ) // in seconds
+    {}
+
+    // @see http://tools.ietf.org/html/rfc6749 for required data per flow
+    bool isValid( bool needsId ) const
+    {
+      if ( mGrantFlow == QgsAuthOAuth2Config::AuthCode || mGrantFlow == QgsAuthOAuth2Config::Implicit )
+      {
+        return ( !mRequestUrl.isEmpty()
+                 && !mTokenUrl.isEmpty()
+                 && !mClientId.isEmpty()
+                 && ( mGrantFlow == QgsAuthOAuth2Config::AuthCode ? !mClientSecret.isEmpty() : true )
+                 && mRedirectPort > 0
+                 && ( needsId ? !mId.isEmpty() : true ) );
+      }
+      else if ( mGrantFlow == QgsAuthOAuth2Config::ResourceOwner )
+      {
+        return ( !mTokenUrl.isEmpty()
+                 && !mUsername.isEmpty()
+                 && !mPassword.isEmpty()
+                 && ( needsId ? !mId.isEmpty() : true ) );
+      }
+      return false;
+    }
+
+    // IDs are not compared
+    bool equals( const QgsAuthOAuth2ConfigDataPrivate &other ) const
+    {
+      return ( other.mVersion == mVersion
+               && other.mConfigType == mConfigType
+               && other.mGrantFlow == mGrantFlow
+               && other.mName == mName
+               && other.mDescription == mDescription
+               && other.mRequestUrl == mRequestUrl
+               && other.mTokenUrl == mTokenUrl
+               && other.mRefreshTokenUrl == mRefreshTokenUrl
+               && other.mRedirectUrl == mRedirectUrl
+               && other.mRedirectPort == mRedirectPort
+               && other.mClientId == mClientId
+               && other.mClientSecret == mClientSecret
+               && other.mUsername == mUsername
+               && other.mPassword == mPassword
+               && other.mScope == mScope
+               && other.mState == mState
+               && other.mApiKey == mApiKey
+               && other.mPersistToken == mPersistToken
+               && other.mAccessMethod == mAccessMethod
+               && other.mRequestTimeout == mRequestTimeout
+               && other.mRefreshLeadTime == mRefreshLeadTime
+               && other.mQueryPairs == mQueryPairs );
+    }
+
+    QString mId;
+    int mVersion;
+    QgsAuthOAuth2Config::ConfigType mConfigType;
+    QgsAuthOAuth2Config::GrantFlow mGrantFlow;
+    QString mName;
+    QString mDescription;
+    QString mRequestUrl;
+    QString mTokenUrl;
+    QString mRefreshTokenUrl;
+    QString mRedirectUrl;
+    int mRedirectPort;
+    QString mClientId;
+    QString mClientSecret;
+    QString mUsername;
+    QString mPassword;
+    QString mScope;
+    QString mState;
+    QString mApiKey;
+    bool mPersistToken;
+    QgsAuthOAuth2Config::AccessMethod mAccessMethod;
+    int mRequestTimeout; // in seconds
+    int mRefreshLeadTime; // in seconds
+    QVariantMap mQueryPairs;
+};
+
+// Set one shared value, detaching only when it actually changes
+template<typename T>
+static bool updateConfigValue( QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate> &d,
+                               T QgsAuthOAuth2ConfigDataPrivate::*member, const T &value )
+{
+  if ( d.constData()->*member == value )
+    return false;
+  d.data()->*member = value;
+  return true;
+}
+
+// Defined configs mapped per canonical directory path, shared by the whole process and
+// reused until the directory or any of its config files changes. A directory with an up to
+// date precompiled bundle keeps the open bundle instead, decoding configs from it on demand.
+class QgsAuthOAuth2DefinedConfigsDir
+{
+  public:
+    QDateTime modified; // newest of the directory's and its config files' modification times
+    QString signature;  // name, modification time and size of each config file
+    QDateTime scanned;
+    QMap<QString, QgsAuthOAuth2ConfigData> configs;
+    QSharedPointer<const QgsAuthOAuth2ConfigBundle> bundle;
+};
+
+static QHash<QString, QgsAuthOAuth2DefinedConfigsDir> sDefinedConfigsDirs;
+static QMutex sDefinedConfigsDirsMutex;
+
+// modification times are only trusted once older than the file system's time resolution,
+// otherwise a change in the same tick as the scan would go unnoticed
+static const qint64 MTIME_RESOLUTION_MSECS = 2000;
+
+
 QgsAuthOAuth2Config::QgsAuthOAuth2Config( QObject *parent )
   : QObject( parent )
-  , mVersion( 1 )
-  , mConfigType( Custom )
-  , mGrantFlow( AuthCode )
-  , mRedirectPort( 7070 )
-  , mPersistToken( false )
-  , mAccessMethod( Header )
-  , mRequestTimeout( 30 ) // in seconds
-  , mQueryPairs( QVariantMap() )
+  , d( new QgsAuthOAuth2ConfigDataPrivate )
   , mValid( false )
+  , mUpdateDepth( 0 )
+  , mUpdatePending( false )
 {
 
   // internal signal bounces
@@ -59,6 +187,7 @@ QgsAuthOAuth2Config::QgsAuthOAuth2Config( QObject *parent )
   connect( this, SIGNAL( persistTokenChanged( bool ) ), this, SIGNAL( configChanged() ) );
   connect( this, SIGNAL( accessMethodChanged( AccessMethod ) ), this, SIGNAL( configChanged() ) );
   connect( this, SIGNAL( requestTimeoutChanged( int ) ), this, SIGNAL( configChanged() ) );
+  connect( this, SIGNAL( refreshLeadTimeChanged( int ) ), this, SIGNAL( configChanged() ) );
   connect( this, SIGNAL( queryPairsChanged( const QVariantMap & ) ), this, SIGNAL( configChanged() ) );
 
   // always recheck validity on any change
@@ -86,6 +215,7 @@ QgsAuthOAuth2Config::QgsAuthOAuth2Config( QObject *parent )
   connect( this, &QgsAuthOAuth2Config::persistTokenChanged, this, &QgsAuthOAuth2Config::configChanged );
   connect( this, &QgsAuthOAuth2Config::accessMethodChanged, this, &QgsAuthOAuth2Config::configChanged );
   connect( this, &QgsAuthOAuth2Config::requestTimeoutChanged, this, &QgsAuthOAuth2Config::configChanged );
+  connect( this, &QgsAuthOAuth2Config::refreshLeadTimeChanged, this, &QgsAuthOAuth2Config::configChanged );
   connect( this, &QgsAuthOAuth2Config::queryPairsChanged, this, &QgsAuthOAuth2Config::configChanged );
 
   // always recheck validity on any change
@@ -100,162 +230,239 @@ QgsAuthOAuth2Config::~QgsAuthOAuth2Config()
 {
 }
 
+QString QgsAuthOAuth2Config::id() const
+{
+  return d->mId;
+}
+
+int QgsAuthOAuth2Config::version() const
+{
+  return d->mVersion;
+}
+
+QgsAuthOAuth2Config::ConfigType QgsAuthOAuth2Config::configType() const
+{
+  return d->mConfigType;
+}
+
+QgsAuthOAuth2Config::GrantFlow QgsAuthOAuth2Config::grantFlow() const
+{
+  return d->mGrantFlow;
+}
+
+QString QgsAuthOAuth2Config::name() const
+{
+  return d->mName;
+}
+
+QString QgsAuthOAuth2Config::description() const
+{
+  return d->mDescription;
+}
+
+QString QgsAuthOAuth2Config::requestUrl() const
+{
+  return d->mRequestUrl;
+}
+
+QString QgsAuthOAuth2Config::tokenUrl() const
+{
+  return d->mTokenUrl;
+}
+
+QString QgsAuthOAuth2Config::refreshTokenUrl() const
+{
+  return d->mRefreshTokenUrl;
+}
+
+QString QgsAuthOAuth2Config::redirectUrl() const
+{
+  return d->mRedirectUrl;
+}
+
+int QgsAuthOAuth2Config::redirectPort() const
+{
+  return d->mRedirectPort;
+}
+
+QString QgsAuthOAuth2Config::clientId() const
+{
+  return d->mClientId;
+}
+
+QString QgsAuthOAuth2Config::clientSecret() const
+{
+  return d->mClientSecret;
+}
+
+QString QgsAuthOAuth2Config::username() const
+{
+  return d->mUsername;
+}
+
+QString QgsAuthOAuth2Config::password() const
+{
+  return d->mPassword;
+}
+
+QString QgsAuthOAuth2Config::scope() const
+{
+  return d->mScope;
+}
+
+QString QgsAuthOAuth2Config::state() const
+{
+  return d->mState;
+}
+
+QString QgsAuthOAuth2Config::apiKey() const
+{
+  return d->mApiKey;
+}
+
+bool QgsAuthOAuth2Config::persistToken() const
+{
+  return d->mPersistToken;
+}
+
+QgsAuthOAuth2Config::AccessMethod QgsAuthOAuth2Config::accessMethod() const
+{
+  return d->mAccessMethod;
+}
+
+int QgsAuthOAuth2Config::requestTimeout() const
+{
+  return d->mRequestTimeout;
+}
+
+int QgsAuthOAuth2Config::refreshLeadTime() const
+{
+  return d->mRefreshLeadTime;
+}
+
+QVariantMap QgsAuthOAuth2Config::queryPairs() const
+{
+  return d->mQueryPairs;
+}
+
 void QgsAuthOAuth2Config::setId( const QString &value )
 {
-  QString preval( mId );
-  mId = value;
-  if ( preval != value ) emit idChanged( mId );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mId, value ) && notifyChange() ) emit idChanged( value );
 }
 
 void QgsAuthOAuth2Config::setVersion( int value )
 {
-  int preval( mVersion );
-  mVersion = value;
-  if ( preval != value ) emit versionChanged( mVersion );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mVersion, value ) && notifyChange() ) emit versionChanged( value );
 }
 
 void QgsAuthOAuth2Config::setConfigType( QgsAuthOAuth2Config::ConfigType value )
 {
-  ConfigType preval( mConfigType );
-  mConfigType = value;
-  if ( preval != value ) emit configTypeChanged( mConfigType );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mConfigType, value ) && notifyChange() ) emit configTypeChanged( value );
 }
 
 void QgsAuthOAuth2Config::setGrantFlow( QgsAuthOAuth2Config::GrantFlow value )
 {
-  GrantFlow preval( mGrantFlow );
-  mGrantFlow = value;
-  if ( preval != value ) emit grantFlowChanged( mGrantFlow );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mGrantFlow, value ) && notifyChange() ) emit grantFlowChanged( value );
 }
 
 void QgsAuthOAuth2Config::setName( const QString &value )
 {
-  QString preval( mName );
-  mName = value;
-  if ( preval != value ) emit nameChanged( mName );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mName, value ) && notifyChange() ) emit nameChanged( value );
 }
 
 void QgsAuthOAuth2Config::setDescription( const QString &value )
 {
-  QString preval( mDescription );
-  mDescription = value;
-  if ( preval != value ) emit descriptionChanged( mDescription );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mDescription, value ) && notifyChange() ) emit descriptionChanged( value );
 }
 
 void QgsAuthOAuth2Config::setRequestUrl( const QString &value )
 {
-  QString preval( mRequestUrl );
-  mRequestUrl = value;
-  if ( preval != value ) emit requestUrlChanged( mRequestUrl );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRequestUrl, value ) && notifyChange() ) emit requestUrlChanged( value );
 }
 
 void QgsAuthOAuth2Config::setTokenUrl( const QString &value )
 {
-  QString preval( mTokenUrl );
-  mTokenUrl = value;
-  if ( preval != value ) emit tokenUrlChanged( mTokenUrl );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mTokenUrl, value ) && notifyChange() ) emit tokenUrlChanged( value );
 }
 
 void QgsAuthOAuth2Config::setRefreshTokenUrl( const QString &value )
 {
-  QString preval( mRefreshTokenUrl );
-  mRefreshTokenUrl = value;
-  if ( preval != value ) emit refreshTokenUrlChanged( mRefreshTokenUrl );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRefreshTokenUrl, value ) && notifyChange() ) emit refreshTokenUrlChanged( value );
 }
 
 void QgsAuthOAuth2Config::setRedirectUrl( const QString &value )
 {
-  QString preval( mRedirectURL );
-  mRedirectURL = value;
-  if ( preval != value ) emit redirectUrlChanged( mRedirectURL );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRedirectUrl, value ) && notifyChange() ) emit redirectUrlChanged( value );
 }
 
 void QgsAuthOAuth2Config::setRedirectPort( int value )
 {
-  int preval( mRedirectPort );
-  mRedirectPort = value;
-  if ( preval != value ) emit redirectPortChanged( mRedirectPort );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRedirectPort, value ) && notifyChange() ) emit redirectPortChanged( value );
 }
 
 void QgsAuthOAuth2Config::setClientId( const QString &value )
 {
-  QString preval( mClientId );
-  mClientId = value;
-  if ( preval != value ) emit clientIdChanged( mClientId );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mClientId, value ) && notifyChange() ) emit clientIdChanged( value );
 }
 
 void QgsAuthOAuth2Config::setClientSecret( const QString &value )
 {
-  QString preval( mClientSecret );
-  mClientSecret = value;
-  if ( preval != value ) emit clientSecretChanged( mClientSecret );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mClientSecret, value ) && notifyChange() ) emit clientSecretChanged( value );
 }
 
 void QgsAuthOAuth2Config::setUsername( const QString &value )
 {
-  QString preval( mUsername );
-  mUsername = value;
-  if ( preval != value ) emit usernameChanged( mUsername );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mUsername, value ) && notifyChange() ) emit usernameChanged( value );
 }
 
 void QgsAuthOAuth2Config::setPassword( const QString &value )
 {
-  QString preval( mPassword );
-  mPassword = value;
-  if ( preval != value ) emit passwordChanged( mPassword );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mPassword, value ) && notifyChange() ) emit passwordChanged( value );
 }
 
 void QgsAuthOAuth2Config::setScope( const QString &value )
 {
-  QString preval( mScope );
-  mScope = value;
-  if ( preval != value ) emit scopeChanged( mScope );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mScope, value ) && notifyChange() ) emit scopeChanged( value );
 }
 
 void QgsAuthOAuth2Config::setState( const QString &value )
 {
-  QString preval( mState );
-  mState = value;
-  if ( preval != value ) emit stateChanged( mState );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mState, value ) && notifyChange() ) emit stateChanged( value );
 }
 
 void QgsAuthOAuth2Config::setApiKey( const QString &value )
 {
-  QString preval( mApiKey );
-  mApiKey = value;
-  if ( preval != value ) emit apiKeyChanged( mApiKey );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mApiKey, value ) && notifyChange() ) emit apiKeyChanged( value );
 }
 
 void QgsAuthOAuth2Config::setPersistToken( bool persist )
 {
-  bool preval( mPersistToken );
-  mPersistToken = persist;
-  if ( preval != persist ) emit persistTokenChanged( mPersistToken );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mPersistToken, persist ) && notifyChange() ) emit persistTokenChanged( persist );
 }
 
 void QgsAuthOAuth2Config::setAccessMethod( QgsAuthOAuth2Config::AccessMethod value )
 {
-  AccessMethod preval( mAccessMethod );
-  mAccessMethod = value;
-  if ( preval != value ) emit accessMethodChanged( mAccessMethod );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mAccessMethod, value ) && notifyChange() ) emit accessMethodChanged( value );
 }
 
 void QgsAuthOAuth2Config::setRequestTimeout( int value )
 {
-  int preval( mRequestTimeout );
-  mRequestTimeout = value;
-  if ( preval != value ) emit requestTimeoutChanged( mRequestTimeout );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRequestTimeout, value ) && notifyChange() ) emit requestTimeoutChanged( value );
+}
+
+void QgsAuthOAuth2Config::setRefreshLeadTime( int value )
+{
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRefreshLeadTime, value ) && notifyChange() ) emit refreshLeadTimeChanged( value );
 }
 
 void QgsAuthOAuth2Config::setQueryPairs( const QVariantMap &pairs )
 {
-  QVariantMap preval( mQueryPairs );
-  mQueryPairs = pairs;
-  if ( preval != pairs ) emit queryPairsChanged( mQueryPairs );
+  if ( updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mQueryPairs, pairs ) && notifyChange() ) emit queryPairsChanged( pairs );
 }
 
 void QgsAuthOAuth2Config::setToDefaults()
 {
+  QgsAuthOAuth2ConfigUpdate update( this );
   setId( QString::null );
   setVersion( 1 );
   setConfigType( QgsAuthOAuth2Config::Custom );
@@ -277,32 +484,42 @@ void QgsAuthOAuth2Config::setToDefaults()
   setPersistToken( false );
   setAccessMethod( QgsAuthOAuth2Config::Header );
   setRequestTimeout( 30 ); // in seconds
+  setRefreshLeadTime( 300 ); // in seconds
   setQueryPairs( QVariantMap() );
 }
 
+void QgsAuthOAuth2Config::beginUpdate()
+{
+  ++mUpdateDepth;
+}
+
+void QgsAuthOAuth2Config::endUpdate()
+{
+  Q_ASSERT( mUpdateDepth > 0 );
+  if ( mUpdateDepth <= 0 || --mUpdateDepth > 0 )
+    return;
+
+  if ( mUpdatePending )
+  {
+    mUpdatePending = false;
+    emit configChanged();
+  }
+}
+
+// private
+bool QgsAuthOAuth2Config::notifyChange()
+{
+  if ( mUpdateDepth > 0 )
+  {
+    mUpdatePending = true;
+    return false;
+  }
+  return true;
+}
+
 bool QgsAuthOAuth2Config::operator==( const QgsAuthOAuth2Config &other ) const
 {
-  return ( other.version() == this->version()
-           && other.configType() == this->configType()
-           && other.grantFlow() == this->grantFlow()
-           && other.name() == this->name()
-           && other.description() == this->description()
-           && other.requestUrl() == this->requestUrl()
-           && other.tokenUrl() == this->tokenUrl()
-           && other.refreshTokenUrl() == this->refreshTokenUrl()
-           && other.redirectUrl() == this->redirectUrl()
-           && other.redirectPort() == this->redirectPort()
-           && other.clientId() == this->clientId()
-           && other.clientSecret() == this->clientSecret()
-           && other.username() == this->username()
-           && other.password() == this->password()
-           && other.scope() == this->scope()
-           && other.state() == this->state()
-           && other.apiKey() == this->apiKey()
-           && other.persistToken() == this->persistToken()
-           && other.accessMethod() == this->accessMethod()
-           && other.requestTimeout() == this->requestTimeout()
-           && other.queryPairs() == this->queryPairs() );
+  return d == other.d || d->equals( *other.d );
 }
 
 bool QgsAuthOAuth2Config::operator!=( const QgsAuthOAuth2Config &other ) const
@@ -325,24 +542,7 @@ void QgsAuthOAuth2Config::validateConfig()
 void QgsAuthOAuth2Config::validateConfigId( bool needsId )
 {
   bool oldvalid = mValid;
-
-  if ( mGrantFlow == AuthCode || mGrantFlow == Implicit )
-  {
-    mValid = ( !requestUrl().isEmpty()
-               && !tokenUrl().isEmpty()
-               && !clientId().isEmpty()
-               && ( mGrantFlow == AuthCode ? !clientSecret().isEmpty() : true )
-               && redirectPort() > 0
-               && ( needsId ? !id().isEmpty() : true ) );
-  }
-  else if ( mGrantFlow == ResourceOwner )
-  {
-    mValid = ( !tokenUrl().isEmpty()
-               && !username().isEmpty()
-               && !password().isEmpty()
-               && ( needsId ? !id().isEmpty() : true ) );
-  }
-
+  mValid = d->isValid( needsId );
   if ( mValid != oldvalid ) emit validityChanged( mValid );
 }
 
@@ -354,13 +554,31 @@ bool QgsAuthOAuth2Config::loadConfigTxt(
 
   if ( format == JSON )
   {
-    QVariant variant = QJsonWrapper::parseJson( configtxt, &res, &errStr );
+    // decoded into a copy while parsing, so a config is left unchanged by invalid text
+    QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate> decoded( d );
+    QgsAuthOAuth2ConfigJsonDecoder decoder( decoded.data() );
+    res = QJsonWrapper::parseJsonObject( configtxt, &decoder, &errStr );
     if ( !res )
     {
       QgsDebugMsg( QStringLiteral( "Error parsing JSON: %1" ).arg( QString( errStr ) ) );
       return res;
     }
-    QJsonWrapper::qvariant2qobject( variant.toMap(), this );
+    if ( decoder.changed() )
+    {
+      d = decoded;
+      if ( notifyChange() )
+        emit configChanged();
+    }
+  }
+  else if ( format == Binary )
+  {
+    QgsAuthOAuth2ConfigData data;
+    if ( !data.loadSerialized( configtxt, Binary ) )
+    {
+      QgsDebugMsg( QStringLiteral( "Error decoding binary config" ) );
+      return false;
+    }
+    setData( data );
   }
   else
   {
@@ -369,6 +587,230 @@ bool QgsAuthOAuth2Config::loadConfigTxt(
   return true;
 }
 
+// Serialized property keys, mirroring the Q_PROPERTY declarations of QgsAuthOAuth2Config
+enum QgsAuthOAuth2ConfigKey
+{
+  KeyId,
+  KeyVersion,
+  KeyConfigType,
+  KeyGrantFlow,
+  KeyName,
+  KeyDescription,
+  KeyRequestUrl,
+  KeyTokenUrl,
+  KeyRefreshTokenUrl,
+  KeyRedirectUrl,
+  KeyRedirectPort,
+  KeyClientId,
+  KeyClientSecret,
+  KeyUsername,
+  KeyPassword,
+  KeyScope,
+  KeyState,
+  KeyApiKey,
+  KeyPersistToken,
+  KeyAccessMethod,
+  KeyRequestTimeout,
+  KeyRefreshLeadTime,
+  KeyQueryPairs,
+  KeyObjectName
+};
+
+static QHash<QString, int> configKeys()
+{
+  QHash<QString, int> keys;
+  keys.insert( QStringLiteral( "id" ), KeyId );
+  keys.insert( QStringLiteral( "version" ), KeyVersion );
+  keys.insert( QStringLiteral( "configType" ), KeyConfigType );
+  keys.insert( QStringLiteral( "grantFlow" ), KeyGrantFlow );
+  keys.insert( QStringLiteral( "name" ), KeyName );
+  keys.insert( QStringLiteral( "description" ), KeyDescription );
+  keys.insert( QStringLiteral( "requestUrl" ), KeyRequestUrl );
+  keys.insert( QStringLiteral( "tokenUrl" ), KeyTokenUrl );
+  keys.insert( QStringLiteral( "refreshTokenUrl" ), KeyRefreshTokenUrl );
+  keys.insert( QStringLiteral( "redirectUrl" ), KeyRedirectUrl );
+  keys.insert( QStringLiteral( "redirectPort" ), KeyRedirectPort );
+  keys.insert( QStringLiteral( "clientId" ), KeyClientId );
+  keys.insert( QStringLiteral( "clientSecret" ), KeyClientSecret );
+  keys.insert( QStringLiteral( "username" ), KeyUsername );
+  keys.insert( QStringLiteral( "password" ), KeyPassword );
+  keys.insert( QStringLiteral( "scope" ), KeyScope );
+  keys.insert( QStringLiteral( "state" ), KeyState );
+  keys.insert( QStringLiteral( "apiKey" ), KeyApiKey );
+  keys.insert( QStringLiteral( "persistToken" ), KeyPersistToken );
+  keys.insert( QStringLiteral( "accessMethod" ), KeyAccessMethod );
+  keys.insert( QStringLiteral( "requestTimeout" ), KeyRequestTimeout );
+  keys.insert( QStringLiteral( "refreshLeadTime" ), KeyRefreshLeadTime );
+  keys.insert( QStringLiteral( "queryPairs" ), KeyQueryPairs );
+  // written along with the properties by QJsonWrapper::qobject2qvariant(), but not a config value
+  keys.insert( QStringLiteral( "objectName" ), KeyObjectName );
+  return keys;
+}
+
+// Assign a converted value to a member, returning whether it changed.
+// Values that do not convert are skipped, as with property-based loading.
+template<typename T>
+static bool decodeValue( const QVariant &value, T &member )
+{
+  if ( !value.canConvert<T>() )
+    return false;
+  T decoded = value.value<T>();
+  if ( decoded == member )
+    return false;
+  member = decoded;
+  return true;
+}
+
+template<typename E>
+static bool decodeEnum( const QVariant &value, E &member )
+{
+  int decoded = static_cast<int>( member );
+  if ( !decodeValue( value, decoded ) )
+    return false;
+  member = static_cast<E>( decoded );
+  return true;
+}
+
+// Decode one serialized property straight into shared values, returning whether it changed
+static bool decodeConfigProperty( QgsAuthOAuth2ConfigDataPrivate *data, const QString &key, const QVariant &value )
+{
+  static const QHash<QString, int> KEYS = configKeys();
+
+  bool changed = false;
+  switch ( KEYS.value( key, -1 ) )
+  {
+    case KeyId:
+      changed = decodeValue( value, data->mId );
+      break;
+    case KeyVersion:
+      changed = decodeValue( value, data->mVersion );
+      break;
+    case KeyConfigType:
+      changed = decodeEnum( value, data->mConfigType );
+      break;
+    case KeyGrantFlow:
+      changed = decodeEnum( value, data->mGrantFlow );
+      break;
+    case KeyName:
+      changed = decodeValue( value, data->mName );
+      break;
+    case KeyDescription:
+      changed = decodeValue( value, data->mDescription );
+      break;
+    case KeyRequestUrl:
+      changed = decodeValue( value, data->mRequestUrl );
+      break;
+    case KeyTokenUrl:
+      changed = decodeValue( value, data->mTokenUrl );
+      break;
+    case KeyRefreshTokenUrl:
+      changed = decodeValue( value, data->mRefreshTokenUrl );
+      break;
+    case KeyRedirectUrl:
+      changed = decodeValue( value, data->mRedirectUrl );
+      break;
+    case KeyRedirectPort:
+      changed = decodeValue( value, data->mRedirectPort );
+      break;
+    case KeyClientId:
+      changed = decodeValue( value, data->mClientId );
+      break;
+    case KeyClientSecret:
+      changed = decodeValue( value, data->mClientSecret );
+      break;
+    case KeyUsername:
+      changed = decodeValue( value, data->mUsername );
+      break;
+    case KeyPassword:
+      changed = decodeValue( value, data->mPassword );
+      break;
+    case KeyScope:
+      changed = decodeValue( value, data->mScope );
+      break;
+    case KeyState:
+      changed = decodeValue( value, data->mState );
+      break;
+    case KeyApiKey:
+      changed = decodeValue( value, data->mApiKey );
+      break;
+    case KeyPersistToken:
+      changed = decodeValue( value, data->mPersistToken );
+      break;
+    case KeyAccessMethod:
+      changed = decodeEnum( value, data->mAccessMethod );
+      break;
+    case KeyRequestTimeout:
+      changed = decodeValue( value, data->mRequestTimeout );
+      break;
+    case KeyRefreshLeadTime:
+      changed = decodeValue( value, data->mRefreshLeadTime );
+      break;
+    case KeyQueryPairs:
+      changed = decodeValue( value, data->mQueryPairs );
+      break;
+    case KeyObjectName:
+      break;
+    default:
+      QgsDebugMsg( QStringLiteral( "Unknown config property: %1" ).arg( key ) );
+      break;
+  }
+
+  return changed;
+}
+
+// Decode serialized properties straight into shared values, returning whether any changed
+static bool decodeConfigProperties( QgsAuthOAuth2ConfigDataPrivate *data, const QVariantMap &properties )
+{
+  bool changed = false;
+  for ( QVariantMap::const_iterator it = properties.constBegin(); it != properties.constEnd(); ++it )
+  {
+    changed |= decodeConfigProperty( data, it.key(), it.value() );
+  }
+  return changed;
+}
+
+// Decodes the members of a JSON config as they are parsed, without building a map of them
+// first. When given keys, only those are decoded and parsing stops once all are read.
+class QgsAuthOAuth2ConfigJsonDecoder : public QJsonWrapper::ObjectHandler
+{
+  public:
+    explicit QgsAuthOAuth2ConfigJsonDecoder( QgsAuthOAuth2ConfigDataPrivate *data,
+        const QStringList &keys = QStringList() )
+      : mData( data )
+      , mKeys( keys.toSet() )
+      , mAllKeys( keys.isEmpty() )
+      , mDecoded( 0 )
+      , mChanged( false )
+    {}
+
+    bool wantsMember( const QString &key ) override
+    {
+      return mAllKeys || mKeys.contains( key );
+    }
+
+    bool member( const QString &key, const QVariant &value ) override
+    {
+      mChanged |= decodeConfigProperty( mData, key, value );
+      ++mDecoded;
+      if ( mAllKeys )
+        return true;
+      mKeys.remove( key );
+      return !mKeys.isEmpty();
+    }
+
+    //! Number of members decoded
+    int decoded() const { return mDecoded; }
+
+    bool changed() const { return mChanged; }
+
+  private:
+    QgsAuthOAuth2ConfigDataPrivate *mData;
+    QSet<QString> mKeys;
+    bool mAllKeys;
+    int mDecoded;
+    bool mChanged;
+};
+
 QByteArray QgsAuthOAuth2Config::saveConfigTxt(
   QgsAuthOAuth2Config::ConfigFormat format, bool pretty, bool *ok ) const
 {
@@ -389,45 +831,542 @@ QByteArray QgsAuthOAuth2Config::saveConfigTxt(
     out = QJsonWrapper::toJson( variant, &res, &errStr, pretty );
     if ( !res )
     {
-      QgsDebugMsg( QStringLiteral( "Error serializing JSON: %1" ).arg( QString( errStr ) ) );
+      QgsDebugMsg( QStringLiteral( "Error serializing JSON: %1" ).arg( QString( errStr ) ) );
+    }
+  }
+  else if ( format == Binary )
+  {
+    out = data().serialized( Binary, pretty, &res );
+  }
+  else
+  {
+    QgsDebugMsg( QStringLiteral( "Unsupported output format" ) );
+  }
+
+  if ( ok ) *ok = res;
+  return out;
+}
+
+QgsAuthOAuth2ConfigData QgsAuthOAuth2Config::data() const
+{
+  return QgsAuthOAuth2ConfigData( d );
+}
+
+void QgsAuthOAuth2Config::setData( const QgsAuthOAuth2ConfigData &data )
+{
+  if ( d == data.d )
+    return;
+  d = data.d;
+  if ( notifyChange() )
+    emit configChanged();
+}
+
+QVariantMap QgsAuthOAuth2Config::mappedProperties() const
+{
+  return data().mappedProperties();
+}
+
+
+// Binary configs are a magic number and format version, followed by every value in a
+// fixed order. Later format versions may only append values, so data of any version stays
+// readable, with values appended by versions newer than this one ignored.
+static const quint32 BINARY_CONFIG_MAGIC = 0x4f413243; // "OA2C", big endian
+static const quint8 BINARY_CONFIG_VERSION = 1;
+
+static QByteArray encodeConfigBinary( const QgsAuthOAuth2ConfigDataPrivate &data )
+{
+  QByteArray out;
+  QDataStream stream( &out, QIODevice::WriteOnly );
+  // oldest stream version both Qt4 and Qt5 builds read
+  stream.setVersion( QDataStream::Qt_4_8 );
+
+  stream << BINARY_CONFIG_MAGIC << BINARY_CONFIG_VERSION
+         << data.mId
+         << static_cast<qint32>( data.mVersion )
+         << static_cast<qint8>( data.mConfigType )
+         << static_cast<qint8>( data.mGrantFlow )
+         << data.mName
+         << data.mDescription
+         << data.mRequestUrl
+         << data.mTokenUrl
+         << data.mRefreshTokenUrl
+         << data.mRedirectUrl
+         << static_cast<qint32>( data.mRedirectPort )
+         << data.mClientId
+         << data.mClientSecret
+         << data.mUsername
+         << data.mPassword
+         << data.mScope
+         << data.mState
+         << data.mApiKey
+         << data.mPersistToken
+         << static_cast<qint8>( data.mAccessMethod )
+         << static_cast<qint32>( data.mRequestTimeout )
+         << static_cast<qint32>( data.mRefreshLeadTime )
+         << data.mQueryPairs;
+  return out;
+}
+
+// Returns newly decoded values, or nullptr if the data is not a (readable) binary config
+static QgsAuthOAuth2ConfigDataPrivate *decodeConfigBinary( const QByteArray &serial )
+{
+  QDataStream stream( serial );
+  stream.setVersion( QDataStream::Qt_4_8 );
+
+  quint32 magic = 0;
+  quint8 version = 0;
+  stream >> magic >> version;
+  if ( stream.status() != QDataStream::Ok || magic != BINARY_CONFIG_MAGIC )
+  {
+    QgsDebugMsg( QStringLiteral( "Not a binary OAuth2 config" ) );
+    return nullptr;
+  }
+  if ( version == 0 )
+  {
+    QgsDebugMsg( QStringLiteral( "Unsupported binary OAuth2 config version: %1" ).arg( version ) );
+    return nullptr;
+  }
+  if ( version > BINARY_CONFIG_VERSION )
+  {
+    QgsDebugMsg( QStringLiteral( "Binary OAuth2 config of newer version %1, ignoring values it added" ).arg( version ) );
+  }
+
+  QScopedPointer<QgsAuthOAuth2ConfigDataPrivate> data( new QgsAuthOAuth2ConfigDataPrivate );
+  qint32 cfgversion, redirectport, requesttimeout, refreshleadtime;
+  qint8 configtype, grantflow, accessmethod;
+  stream >> data->mId
+         >> cfgversion
+         >> configtype
+         >> grantflow
+         >> data->mName
+         >> data->mDescription
+         >> data->mRequestUrl
+         >> data->mTokenUrl
+         >> data->mRefreshTokenUrl
+         >> data->mRedirectUrl
+         >> redirectport
+         >> data->mClientId
+         >> data->mClientSecret
+         >> data->mUsername
+         >> data->mPassword
+         >> data->mScope
+         >> data->mState
+         >> data->mApiKey
+         >> data->mPersistToken
+         >> accessmethod
+         >> requesttimeout
+         >> refreshleadtime
+         >> data->mQueryPairs;
+  if ( stream.status() != QDataStream::Ok )
+  {
+    QgsDebugMsg( QStringLiteral( "Truncated or corrupt binary OAuth2 config" ) );
+    return nullptr;
+  }
+
+  data->mVersion = cfgversion;
+  data->mConfigType = static_cast<QgsAuthOAuth2Config::ConfigType>( configtype );
+  data->mGrantFlow = static_cast<QgsAuthOAuth2Config::GrantFlow>( grantflow );
+  data->mRedirectPort = redirectport;
+  data->mAccessMethod = static_cast<QgsAuthOAuth2Config::AccessMethod>( accessmethod );
+  data->mRequestTimeout = requesttimeout;
+  data->mRefreshLeadTime = refreshleadtime;
+  return data.take();
+}
+
+QgsAuthOAuth2ConfigData::QgsAuthOAuth2ConfigData()
+  : d( new QgsAuthOAuth2ConfigDataPrivate )
+{
+}
+
+QgsAuthOAuth2ConfigData::QgsAuthOAuth2ConfigData( const QgsAuthOAuth2ConfigData &other )
+  : d( other.d )
+{
+}
+
+QgsAuthOAuth2ConfigData::QgsAuthOAuth2ConfigData( const QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate> &data )
+  : d( data )
+{
+}
+
+QgsAuthOAuth2ConfigData::~QgsAuthOAuth2ConfigData()
+{
+}
+
+QgsAuthOAuth2ConfigData &QgsAuthOAuth2ConfigData::operator=( const QgsAuthOAuth2ConfigData &other )
+{
+  d = other.d;
+  return *this;
+}
+
+bool QgsAuthOAuth2ConfigData::operator==( const QgsAuthOAuth2ConfigData &other ) const
+{
+  return d == other.d || d->equals( *other.d );
+}
+
+bool QgsAuthOAuth2ConfigData::operator!=( const QgsAuthOAuth2ConfigData &other ) const
+{
+  return !( *this == other );
+}
+
+bool QgsAuthOAuth2ConfigData::isValid( bool needsId ) const
+{
+  return d->isValid( needsId );
+}
+
+QString QgsAuthOAuth2ConfigData::id() const
+{
+  return d->mId;
+}
+
+void QgsAuthOAuth2ConfigData::setId( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mId, value );
+}
+
+int QgsAuthOAuth2ConfigData::version() const
+{
+  return d->mVersion;
+}
+
+void QgsAuthOAuth2ConfigData::setVersion( int value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mVersion, value );
+}
+
+QgsAuthOAuth2Config::ConfigType QgsAuthOAuth2ConfigData::configType() const
+{
+  return d->mConfigType;
+}
+
+void QgsAuthOAuth2ConfigData::setConfigType( QgsAuthOAuth2Config::ConfigType value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mConfigType, value );
+}
+
+QgsAuthOAuth2Config::GrantFlow QgsAuthOAuth2ConfigData::grantFlow() const
+{
+  return d->mGrantFlow;
+}
+
+void QgsAuthOAuth2ConfigData::setGrantFlow( QgsAuthOAuth2Config::GrantFlow value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mGrantFlow, value );
+}
+
+QString QgsAuthOAuth2ConfigData::name() const
+{
+  return d->mName;
+}
+
+void QgsAuthOAuth2ConfigData::setName( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mName, value );
+}
+
+QString QgsAuthOAuth2ConfigData::description() const
+{
+  return d->mDescription;
+}
+
+void QgsAuthOAuth2ConfigData::setDescription( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mDescription, value );
+}
+
+QString QgsAuthOAuth2ConfigData::requestUrl() const
+{
+  return d->mRequestUrl;
+}
+
+void QgsAuthOAuth2ConfigData::setRequestUrl( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRequestUrl, value );
+}
+
+QString QgsAuthOAuth2ConfigData::tokenUrl() const
+{
+  return d->mTokenUrl;
+}
+
+void QgsAuthOAuth2ConfigData::setTokenUrl( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mTokenUrl, value );
+}
+
+QString QgsAuthOAuth2ConfigData::refreshTokenUrl() const
+{
+  return d->mRefreshTokenUrl;
+}
+
+void QgsAuthOAuth2ConfigData::setRefreshTokenUrl( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRefreshTokenUrl, value );
+}
+
+QString QgsAuthOAuth2ConfigData::redirectUrl() const
+{
+  return d->mRedirectUrl;
+}
+
+void QgsAuthOAuth2ConfigData::setRedirectUrl( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRedirectUrl, value );
+}
+
+int QgsAuthOAuth2ConfigData::redirectPort() const
+{
+  return d->mRedirectPort;
+}
+
+void QgsAuthOAuth2ConfigData::setRedirectPort( int value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRedirectPort, value );
+}
+
+QString QgsAuthOAuth2ConfigData::clientId() const
+{
+  return d->mClientId;
+}
+
+void QgsAuthOAuth2ConfigData::setClientId( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mClientId, value );
+}
+
+QString QgsAuthOAuth2ConfigData::clientSecret() const
+{
+  return d->mClientSecret;
+}
+
+void QgsAuthOAuth2ConfigData::setClientSecret( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mClientSecret, value );
+}
+
+QString QgsAuthOAuth2ConfigData::username() const
+{
+  return d->mUsername;
+}
+
+void QgsAuthOAuth2ConfigData::setUsername( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mUsername, value );
+}
+
+QString QgsAuthOAuth2ConfigData::password() const
+{
+  return d->mPassword;
+}
+
+void QgsAuthOAuth2ConfigData::setPassword( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mPassword, value );
+}
+
+QString QgsAuthOAuth2ConfigData::scope() const
+{
+  return d->mScope;
+}
+
+void QgsAuthOAuth2ConfigData::setScope( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mScope, value );
+}
+
+QString QgsAuthOAuth2ConfigData::state() const
+{
+  return d->mState;
+}
+
+void QgsAuthOAuth2ConfigData::setState( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mState, value );
+}
+
+QString QgsAuthOAuth2ConfigData::apiKey() const
+{
+  return d->mApiKey;
+}
+
+void QgsAuthOAuth2ConfigData::setApiKey( const QString &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mApiKey, value );
+}
+
+bool QgsAuthOAuth2ConfigData::persistToken() const
+{
+  return d->mPersistToken;
+}
+
+void QgsAuthOAuth2ConfigData::setPersistToken( bool value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mPersistToken, value );
+}
+
+QgsAuthOAuth2Config::AccessMethod QgsAuthOAuth2ConfigData::accessMethod() const
+{
+  return d->mAccessMethod;
+}
+
+void QgsAuthOAuth2ConfigData::setAccessMethod( QgsAuthOAuth2Config::AccessMethod value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mAccessMethod, value );
+}
+
+int QgsAuthOAuth2ConfigData::requestTimeout() const
+{
+  return d->mRequestTimeout;
+}
+
+void QgsAuthOAuth2ConfigData::setRequestTimeout( int value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRequestTimeout, value );
+}
+
+int QgsAuthOAuth2ConfigData::refreshLeadTime() const
+{
+  return d->mRefreshLeadTime;
+}
+
+void QgsAuthOAuth2ConfigData::setRefreshLeadTime( int value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mRefreshLeadTime, value );
+}
+
+QVariantMap QgsAuthOAuth2ConfigData::queryPairs() const
+{
+  return d->mQueryPairs;
+}
+
+void QgsAuthOAuth2ConfigData::setQueryPairs( const QVariantMap &value )
+{
+  updateConfigValue( d, &QgsAuthOAuth2ConfigDataPrivate::mQueryPairs, value );
+}
+
+QVariantMap QgsAuthOAuth2ConfigData::mappedProperties() const
+{
+  QVariantMap vmap;
+  vmap.insert( QStringLiteral( "apiKey" ), d->mApiKey );
+  vmap.insert( QStringLiteral( "clientId" ), d->mClientId );
+  vmap.insert( QStringLiteral( "clientSecret" ), d->mClientSecret );
+  vmap.insert( QStringLiteral( "configType" ), static_cast<int>( d->mConfigType ) );
+  vmap.insert( QStringLiteral( "description" ), d->mDescription );
+  vmap.insert( QStringLiteral( "grantFlow" ), static_cast<int>( d->mGrantFlow ) );
+  vmap.insert( QStringLiteral( "id" ), d->mId );
+  vmap.insert( QStringLiteral( "name" ), d->mName );
+  vmap.insert( QStringLiteral( "password" ), d->mPassword );
+  vmap.insert( QStringLiteral( "persistToken" ), d->mPersistToken );
+  vmap.insert( QStringLiteral( "queryPairs" ), d->mQueryPairs );
+  vmap.insert( QStringLiteral( "redirectPort" ), d->mRedirectPort );
+  vmap.insert( QStringLiteral( "redirectUrl" ), d->mRedirectUrl );
+  vmap.insert( QStringLiteral( "refreshLeadTime" ), d->mRefreshLeadTime );
+  vmap.insert( QStringLiteral( "refreshTokenUrl" ), d->mRefreshTokenUrl );
+  vmap.insert( QStringLiteral( "accessMethod" ), static_cast<int>( d->mAccessMethod ) );
+  vmap.insert( QStringLiteral( "requestTimeout" ), d->mRequestTimeout );
+  vmap.insert( QStringLiteral( "requestUrl" ), d->mRequestUrl );
+  vmap.insert( QStringLiteral( "scope" ), d->mScope );
+  vmap.insert( QStringLiteral( "state" ), d->mState );
+  vmap.insert( QStringLiteral( "tokenUrl" ), d->mTokenUrl );
+  vmap.insert( QStringLiteral( "username" ), d->mUsername );
+  vmap.insert( QStringLiteral( "version" ), d->mVersion );
+
+  return vmap;
+}
+
+bool QgsAuthOAuth2ConfigData::loadMappedProperties( const QVariantMap &properties )
+{
+  return decodeConfigProperties( d.data(), properties );
+}
+
+QByteArray QgsAuthOAuth2ConfigData::serialized( QgsAuthOAuth2Config::ConfigFormat format, bool pretty, bool *ok ) const
+{
+  QByteArray out;
+  QByteArray errStr;
+  bool res = false;
+
+  if ( format == QgsAuthOAuth2Config::JSON )
+  {
+    out = QJsonWrapper::toJson( mappedProperties(), &res, &errStr, pretty );
+    if ( !res )
+    {
+      QgsDebugMsg( QStringLiteral( "Error serializing JSON: %1" ).arg( QString( errStr ) ) );
+    }
+  }
+  else if ( format == QgsAuthOAuth2Config::Binary )
+  {
+    out = encodeConfigBinary( *d );
+    res = true;
+  }
+  else
+  {
+    QgsDebugMsg( QStringLiteral( "Unsupported output format" ) );
+  }
+
+  if ( ok ) *ok = res;
+  return out;
+}
+
+bool QgsAuthOAuth2ConfigData::loadSerialized( const QByteArray &serial, QgsAuthOAuth2Config::ConfigFormat format )
+{
+  QgsAuthOAuth2ConfigDataPrivate *decoded = nullptr;
+
+  if ( format == QgsAuthOAuth2Config::JSON )
+  {
+    QScopedPointer<QgsAuthOAuth2ConfigDataPrivate> data( new QgsAuthOAuth2ConfigDataPrivate );
+    QgsAuthOAuth2ConfigJsonDecoder decoder( data.data() );
+    QByteArray errStr;
+    if ( !QJsonWrapper::parseJsonObject( serial, &decoder, &errStr ) )
+    {
+      QgsDebugMsg( QStringLiteral( "Error parsing JSON: %1" ).arg( QString( errStr ) ) );
+      return false;
     }
+    if ( decoder.decoded() == 0 )
+    {
+      return false;
+    }
+    decoded = data.take();
+  }
+  else if ( format == QgsAuthOAuth2Config::Binary )
+  {
+    decoded = decodeConfigBinary( serial );
   }
   else
   {
-    QgsDebugMsg( QStringLiteral( "Unsupported output format" ) );
+    QgsDebugMsg( QStringLiteral( "Unsupported input format" ) );
   }
 
-  if ( ok ) *ok = res;
-  return out;
+  if ( !decoded )
+  {
+    return false;
+  }
+  d = QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate>( decoded );
+  return true;
 }
 
-QVariantMap QgsAuthOAuth2Config::mappedProperties() const
+bool QgsAuthOAuth2ConfigData::loadSerializedKeys( const QByteArray &serial,
+    const QStringList &keys,
+    QgsAuthOAuth2Config::ConfigFormat format )
 {
-  QVariantMap vmap;
-  vmap.insert( QStringLiteral( "apiKey" ), this->apiKey() );
-  vmap.insert( QStringLiteral( "clientId" ), this->clientId() );
-  vmap.insert( QStringLiteral( "clientSecret" ), this->clientSecret() );
-  vmap.insert( QStringLiteral( "configType" ), static_cast<int>( this->configType() ) );
-  vmap.insert( QStringLiteral( "description" ), this->description() );
-  vmap.insert( QStringLiteral( "grantFlow" ), static_cast<int>( this->grantFlow() ) );
-  vmap.insert( QStringLiteral( "id" ), this->id() );
-  vmap.insert( QStringLiteral( "name" ), this->name() );
-  vmap.insert( QStringLiteral( "password" ), this->password() );
-  vmap.insert( QStringLiteral( "persistToken" ), this->persistToken() );
-  vmap.insert( QStringLiteral( "queryPairs" ), this->queryPairs() );
-  vmap.insert( QStringLiteral( "redirectPort" ), this->redirectPort() );
-  vmap.insert( QStringLiteral( "redirectUrl" ), this->redirectUrl() );
-  vmap.insert( QStringLiteral( "refreshTokenUrl" ), this->refreshTokenUrl() );
-  vmap.insert( QStringLiteral( "accessMethod" ), static_cast<int>( this->accessMethod() ) );
-  vmap.insert( QStringLiteral( "requestTimeout" ), this->requestTimeout() );
-  vmap.insert( QStringLiteral( "requestUrl" ), this->requestUrl() );
-  vmap.insert( QStringLiteral( "scope" ), this->scope() );
-  vmap.insert( QStringLiteral( "state" ), this->state() );
-  vmap.insert( QStringLiteral( "tokenUrl" ), this->tokenUrl() );
-  vmap.insert( QStringLiteral( "username" ), this->username() );
-  vmap.insert( QStringLiteral( "version" ), this->version() );
+  if ( format != QgsAuthOAuth2Config::JSON || keys.isEmpty() )
+  {
+    // binary configs are cheap to decode whole
+    return loadSerialized( serial, format );
+  }
 
-  return vmap;
+  QScopedPointer<QgsAuthOAuth2ConfigDataPrivate> data( new QgsAuthOAuth2ConfigDataPrivate );
+  QgsAuthOAuth2ConfigJsonDecoder decoder( data.data(), keys );
+  QByteArray errStr;
+  if ( !QJsonWrapper::parseJsonObject( serial, &decoder, &errStr ) )
+  {
+    QgsDebugMsg( QStringLiteral( "Error parsing JSON: %1" ).arg( QString( errStr ) ) );
+    return false;
+  }
+  if ( decoder.decoded() == 0 )
+  {
+    return false;
+  }
+  d = QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate>( data.take() );
+  return true;
 }
 
 // static
@@ -449,6 +1388,13 @@ QByteArray QgsAuthOAuth2Config::serializeFromVariant(
       QgsDebugMsg( QStringLiteral( "Error serializing JSON: %1" ).arg( QString( errStr ) ) );
     }
   }
+  else if ( format == Binary )
+  {
+    // binary configs hold every value, so missing properties are encoded as defaults
+    QgsAuthOAuth2ConfigData data;
+    data.loadMappedProperties( variant );
+    out = data.serialized( Binary, pretty, &res );
+  }
   else
   {
     QgsDebugMsg( QStringLiteral( "Unsupported output format" ) );
@@ -492,6 +1438,15 @@ QVariantMap QgsAuthOAuth2Config::variantFromSerialized(
       return vmap;
     }
   }
+  else if ( format == Binary )
+  {
+    QgsAuthOAuth2ConfigData data;
+    res = data.loadSerialized( serial, Binary );
+    if ( res )
+    {
+      vmap = data.mappedProperties();
+    }
+  }
   else
   {
     QgsDebugMsg( QStringLiteral( "Unsupported output format" ) );
@@ -501,6 +1456,35 @@ QVariantMap QgsAuthOAuth2Config::variantFromSerialized(
   return vmap;
 }
 
+// static
+QByteArray QgsAuthOAuth2Config::configTxtFromStored( const QString &stored, QgsAuthOAuth2Config::ConfigFormat *format )
+{
+  QByteArray configtxt( stored.toUtf8() );
+  // JSON text always starts with an object; anything else may be a wrapped binary config
+  if ( !configtxt.trimmed().startsWith( '{' ) )
+  {
+    QByteArray binary( QByteArray::fromBase64( configtxt ) );
+    if ( binary.startsWith( "OA2C" ) ) // BINARY_CONFIG_MAGIC
+    {
+      if ( format ) *format = Binary;
+      return binary;
+    }
+  }
+  if ( format ) *format = JSON;
+  return configtxt;
+}
+
+// static
+QString QgsAuthOAuth2Config::storedFromConfigTxt( const QByteArray &configtxt, QgsAuthOAuth2Config::ConfigFormat format )
+{
+  // config map values are text
+  if ( format == Binary )
+  {
+    return QString::fromLatin1( configtxt.toBase64() );
+  }
+  return QString( configtxt );
+}
+
 //static
 bool QgsAuthOAuth2Config::writeOAuth2Config(
   const QString &filepath,
@@ -535,6 +1519,9 @@ bool QgsAuthOAuth2Config::writeOAuth2Config(
     return false;
   }
 
+  // overwriting a file in place may leave its directory's modification time as is
+  invalidateMappedOAuth2ConfigsCache( QFileInfo( file_path ).absolutePath() );
+
   if ( !config_file.setPermissions( QFile::ReadOwner | QFile::WriteOwner ) )
   {
     QgsDebugMsg( QStringLiteral( "FAILED to set permissions config file: %1" ).arg( file_path ) );
@@ -544,18 +1531,92 @@ bool QgsAuthOAuth2Config::writeOAuth2Config(
   return true;
 }
 
-// static
-QList<QgsAuthOAuth2Config *> QgsAuthOAuth2Config::loadOAuth2Configs(
+// A config file, read and parsed on a worker thread
+class QgsAuthOAuth2ConfigFile
+{
+  public:
+    QgsAuthOAuth2ConfigFile()
+      : parsed( false )
+    {}
+
+    QString fileName;
+    QByteArray text;
+    QgsAuthOAuth2ConfigData config;
+    bool parsed;
+};
+
+// Reads and parses one config file; only touches its own data, so it can run concurrently.
+// Configs are decoded as they are parsed, only the given keys when there are any.
+class QgsAuthOAuth2ConfigFileParser
+{
+  public:
+    typedef QgsAuthOAuth2ConfigFile result_type;
+
+    QgsAuthOAuth2ConfigFileParser( const QString &configdirectory,
+                                   QgsAuthOAuth2Config::ConfigFormat format,
+                                   const QStringList &keys )
+      : mConfigDirectory( configdirectory )
+      , mFormat( format )
+      , mKeys( keys )
+    {}
+
+    QgsAuthOAuth2ConfigFile operator()( const QString &configfile ) const
+    {
+      QgsAuthOAuth2ConfigFile result;
+      result.fileName = configfile;
+
+      QFile cfile( mConfigDirectory + QStringLiteral( "/" ) + configfile );
+      if ( cfile.exists() )
+      {
+        bool ret = cfile.open( QIODevice::ReadOnly | QIODevice::Text );
+        if ( ret )
+        {
+          result.text = cfile.readAll();
+        }
+        else
+        {
+          QgsDebugMsg( QStringLiteral( "FAILED to open config for reading: %1" ).arg( configfile ) );
+        }
+        cfile.close();
+      }
+
+      if ( result.text.isEmpty() )
+      {
+        QgsDebugMsg( QStringLiteral( "EMPTY read of config: %1" ).arg( configfile ) );
+        return result;
+      }
+
+      result.parsed = result.config.loadSerializedKeys( result.text, mKeys, mFormat );
+      if ( !result.parsed )
+      {
+        QgsDebugMsg( QStringLiteral( "FAILED to load config: %1" ).arg( configfile ) );
+      }
+      return result;
+    }
+
+  private:
+    QString mConfigDirectory;
+    QgsAuthOAuth2Config::ConfigFormat mFormat;
+    QStringList mKeys;
+};
+
+// below this many files, handing them to the thread pool costs more than it saves
+static const int PARALLEL_CONFIG_FILES_MIN = 4;
+
+// Read and parse the config files of a directory, concurrently for larger directories.
+// Results are in file name order either way, so later files override earlier ones
+// deterministically when merged in sequence.
+static QList<QgsAuthOAuth2ConfigFile> readOAuth2ConfigFiles(
   const QString &configdirectory,
-  QObject *parent,
   QgsAuthOAuth2Config::ConfigFormat format,
-  bool *ok )
+  bool *ok,
+  const QStringList &keys = QStringList() )
 {
-  QList<QgsAuthOAuth2Config *> configs = QList<QgsAuthOAuth2Config *>();
+  QList<QgsAuthOAuth2ConfigFile> configfiles;
   bool res = false;
   QStringList namefilters;
 
-  if ( format == JSON )
+  if ( format == QgsAuthOAuth2Config::JSON )
   {
     namefilters << QStringLiteral( "*.json" );
   }
@@ -563,57 +1624,69 @@ QList<QgsAuthOAuth2Config *> QgsAuthOAuth2Config::loadOAuth2Configs(
   {
     QgsDebugMsg( QStringLiteral( "Unsupported output format" ) );
     if ( ok ) *ok = res;
-    return configs;
+    return configfiles;
   }
 
   QDir configdir( configdirectory );
   configdir.setNameFilters( namefilters );
-  QStringList configfiles = configdir.entryList( namefilters );
+  QStringList filenames = configdir.entryList( namefilters );
 
-  if ( configfiles.size() > 0 )
+  if ( filenames.size() > 0 )
   {
     QgsDebugMsg( QStringLiteral( "Config files found in: %1...\n%2" )
-                 .arg( configdir.path(), configfiles.join( QStringLiteral( ", " ) ) ) );
+                 .arg( configdir.path(), filenames.join( QStringLiteral( ", " ) ) ) );
   }
   else
   {
     QgsDebugMsg( QStringLiteral( "No config files found in: %1" ).arg( configdir.path() ) );
     if ( ok ) *ok = res;
-    return configs;
+    return configfiles;
   }
 
-  // Add entries
-  Q_FOREACH ( const QString &configfile, configfiles )
+  QgsAuthOAuth2ConfigFileParser parser( configdir.path(), format, keys );
+  if ( filenames.size() < PARALLEL_CONFIG_FILES_MIN )
   {
-    QByteArray configtxt;
-    QFile cfile( configdir.path() + QStringLiteral( "/" ) + configfile );
-    if ( cfile.exists() )
+    Q_FOREACH ( const QString &filename, filenames )
     {
-      bool ret = cfile.open( QIODevice::ReadOnly | QIODevice::Text );
-      if ( ret )
-      {
-        configtxt = cfile.readAll();
-      }
-      else
-      {
-        QgsDebugMsg( QStringLiteral( "FAILED to open config for reading: %1" ).arg( configfile ) );
-      }
-      cfile.close();
+      configfiles << parser( filename );
     }
+  }
+  else
+  {
+    configfiles = QtConcurrent::blockingMapped<QList<QgsAuthOAuth2ConfigFile> >( filenames, parser );
+  }
 
-    if ( configtxt.isEmpty() )
-    {
-      QgsDebugMsg( QStringLiteral( "EMPTY read of config: %1" ).arg( configfile ) );
-      continue;
-    }
+  if ( ok ) *ok = true;
+  return configfiles;
+}
 
-    QgsAuthOAuth2Config *config = new QgsAuthOAuth2Config( parent );
-    if ( !config->loadConfigTxt( configtxt, format ) )
+// static
+QList<QgsAuthOAuth2Config *> QgsAuthOAuth2Config::loadOAuth2Configs(
+  const QString &configdirectory,
+  QObject *parent,
+  QgsAuthOAuth2Config::ConfigFormat format,
+  bool *ok )
+{
+  QList<QgsAuthOAuth2Config *> configs = QList<QgsAuthOAuth2Config *>();
+  bool res = false;
+
+  QList<QgsAuthOAuth2ConfigFile> configfiles = readOAuth2ConfigFiles( configdirectory, format, &res );
+  if ( !res )
+  {
+    if ( ok ) *ok = res;
+    return configs;
+  }
+
+  // Add entries; objects are created here, in the caller's thread, from the parsed files
+  Q_FOREACH ( const QgsAuthOAuth2ConfigFile &configfile, configfiles )
+  {
+    // empty configs are not parsed
+    if ( !configfile.parsed )
     {
-      QgsDebugMsg( QStringLiteral( "FAILED to load config: %1" ).arg( configfile ) );
-      config->deleteLater();
       continue;
     }
+    QgsAuthOAuth2Config *config = new QgsAuthOAuth2Config( parent );
+    config->setData( configfile.config );
     configs << config;
   }
 
@@ -628,90 +1701,126 @@ QgsStringMap QgsAuthOAuth2Config::mapOAuth2Configs(
   QgsAuthOAuth2Config::ConfigFormat format,
   bool *ok )
 {
+  Q_UNUSED( parent )
   QgsStringMap configs = QgsStringMap();
   bool res = false;
-  QStringList namefilters;
 
-  if ( format == JSON )
-  {
-    namefilters << QStringLiteral( "*.json" );
-  }
-  else
+  QList<QgsAuthOAuth2ConfigFile> configfiles = readOAuth2ConfigFiles( configdirectory, format, &res );
+  if ( !res )
   {
-    QgsDebugMsg( QStringLiteral( "Unsupported output format" ) );
     if ( ok ) *ok = res;
     return configs;
   }
 
-  QDir configdir( configdirectory );
-  configdir.setNameFilters( namefilters );
-  QStringList configfiles = configdir.entryList( namefilters );
-
-  if ( configfiles.size() > 0 )
+  // Add entries
+  Q_FOREACH ( const QgsAuthOAuth2ConfigFile &configfile, configfiles )
   {
-    QgsDebugMsg( QStringLiteral( "Config files found in: %1...\n%2" )
-                 .arg( configdir.path(), configfiles.join( QStringLiteral( ", " ) ) ) );
+    // validate the config before caching it, reading its id from the decoded values
+    if ( !configfile.parsed )
+    {
+      continue;
+    }
+    QString id = configfile.config.id();
+    if ( id.isEmpty() )
+    {
+      QgsDebugMsg( QStringLiteral( "NO ID SET for config: %1" ).arg( configfile.fileName ) );
+      continue;
+    }
+    configs.insert( id, configfile.text );
   }
-  else
+
+  if ( ok ) *ok = true;
+  return configs;
+}
+
+// static
+QMap<QString, QgsAuthOAuth2ConfigData> QgsAuthOAuth2Config::mapOAuth2ConfigData(
+  const QString &configdirectory,
+  QgsAuthOAuth2Config::ConfigFormat format,
+  bool *ok )
+{
+  QMap<QString, QgsAuthOAuth2ConfigData> configs;
+  bool res = false;
+
+  QList<QgsAuthOAuth2ConfigFile> configfiles = readOAuth2ConfigFiles( configdirectory, format, &res );
+  if ( !res )
   {
-    QgsDebugMsg( QStringLiteral( "No config files found in: %1" ).arg( configdir.path() ) );
     if ( ok ) *ok = res;
     return configs;
   }
 
-  // Add entries
-  Q_FOREACH ( const QString &configfile, configfiles )
+  // Add entries, decoded once for all consumers of the defined configs cache
+  Q_FOREACH ( const QgsAuthOAuth2ConfigFile &configfile, configfiles )
   {
-    QByteArray configtxt;
-    QFile cfile( configdir.path() + QStringLiteral( "/" ) + configfile );
-    if ( cfile.exists() )
+    if ( !configfile.parsed )
     {
-      bool ret = cfile.open( QIODevice::ReadOnly | QIODevice::Text );
-      if ( ret )
-      {
-        configtxt = cfile.readAll();
-      }
-      else
-      {
-        QgsDebugMsg( QStringLiteral( "FAILED to open config for reading: %1" ).arg( configfile ) );
-      }
-      cfile.close();
+      continue;
     }
-
-    if ( configtxt.isEmpty() )
+    if ( configfile.config.id().isEmpty() )
     {
-      QgsDebugMsg( QStringLiteral( "EMPTY read of config: %1" ).arg( configfile ) );
+      QgsDebugMsg( QStringLiteral( "NO ID SET for config: %1" ).arg( configfile.fileName ) );
       continue;
     }
+    configs.insert( configfile.config.id(), configfile.config );
+  }
 
-    // validate the config before caching it
-    QgsAuthOAuth2Config *config = new QgsAuthOAuth2Config( parent );
-    if ( !config->loadConfigTxt( configtxt, format ) )
+  if ( ok ) *ok = true;
+  return configs;
+}
+
+// static
+QStringList QgsAuthOAuth2Config::listingKeys()
+{
+  return QStringList() << QStringLiteral( "id" )
+         << QStringLiteral( "name" )
+         << QStringLiteral( "grantFlow" )
+         << QStringLiteral( "description" );
+}
+
+// static
+QMap<QString, QgsAuthOAuth2ConfigData> QgsAuthOAuth2Config::mapOAuth2ConfigSummaries(
+  const QString &configdirectory,
+  const QStringList &keys,
+  QgsAuthOAuth2Config::ConfigFormat format,
+  bool *ok )
+{
+  QMap<QString, QgsAuthOAuth2ConfigData> configs;
+  bool res = false;
+
+  QStringList summarykeys( keys.isEmpty() ? listingKeys() : keys );
+  if ( !summarykeys.contains( QStringLiteral( "id" ) ) )
+  {
+    summarykeys << QStringLiteral( "id" );
+  }
+
+  QList<QgsAuthOAuth2ConfigFile> configfiles = readOAuth2ConfigFiles( configdirectory, format, &res, summarykeys );
+  if ( !res )
+  {
+    if ( ok ) *ok = res;
+    return configs;
+  }
+
+  Q_FOREACH ( const QgsAuthOAuth2ConfigFile &configfile, configfiles )
+  {
+    if ( !configfile.parsed )
     {
-      QgsDebugMsg( QStringLiteral( "FAILED to load config: %1" ).arg( configfile ) );
-      config->deleteLater();
       continue;
     }
-    if ( config->id().isEmpty() )
+    if ( configfile.config.id().isEmpty() )
     {
-      QgsDebugMsg( QStringLiteral( "NO ID SET for config: %1" ).arg( configfile ) );
-      config->deleteLater();
+      QgsDebugMsg( QStringLiteral( "NO ID SET for config: %1" ).arg( configfile.fileName ) );
       continue;
     }
-    configs.insert( config->id(), configtxt );
-    config->deleteLater();
+    configs.insert( configfile.config.id(), configfile.config );
   }
 
   if ( ok ) *ok = true;
   return configs;
 }
 
-QgsStringMap QgsAuthOAuth2Config::mappedOAuth2ConfigsCache(QObject *parent, const QString &extradir )
+// Standard directories of defined configs, in order of override preference
+static QStringList definedConfigsDirs( const QString &extradir )
 {
-  QgsStringMap configs;
-  bool ok = false;
-
-  // Load from default locations
   QStringList configdirs;
   // in order of override preference, i.e. user over pkg dir
   configdirs << QgsAuthOAuth2Config::oauth2ConfigsPkgDataDir()
@@ -722,29 +1831,183 @@ QgsStringMap QgsAuthOAuth2Config::mappedOAuth2ConfigsCache(QObject *parent, cons
     // configs of similar IDs in this dir will override existing in standard dirs
     configdirs << extradir;
   }
+  return configdirs;
+}
+
+// Configs of a defined configs directory, scanned or opened only when not cached or out of date.
+// Returns false if the directory does not exist.
+// With summaries, a directory not yet cached is only partially decoded, and left uncached.
+static bool definedConfigsDir( const QString &configdir, QgsAuthOAuth2DefinedConfigsDir *dirconfigs,
+                               bool summaries = false )
+{
+  QFileInfo configdirinfo( configdir );
+  if ( !configdirinfo.exists() || !configdirinfo.isDir() )
+  {
+    return false;
+  }
+  QString dirpath( configdirinfo.canonicalFilePath() );
+
+  // adding, removing or renaming config files changes the directory's modification time,
+  // but editing one in place only changes the file's own
+  QDateTime dirmodified( configdirinfo.lastModified() );
+  QDateTime configsmodified;
+  QString signature;
+  QFileInfoList configinfos( QDir( dirpath ).entryInfoList( QStringList() << QStringLiteral( "*.json" ),
+                             QDir::Files, QDir::Name ) );
+  Q_FOREACH ( const QFileInfo &configinfo, configinfos )
+  {
+    if ( !configsmodified.isValid() || configinfo.lastModified() > configsmodified )
+    {
+      configsmodified = configinfo.lastModified();
+    }
+    signature += QStringLiteral( "%1:%2:%3;" ).arg( configinfo.fileName() )
+                 .arg( configinfo.lastModified().toMSecsSinceEpoch() ).arg( configinfo.size() );
+  }
+  QDateTime modified( configsmodified.isValid() ? qMax( dirmodified, configsmodified ) : dirmodified );
+
+  {
+    QMutexLocker locker( &sDefinedConfigsDirsMutex );
+    QHash<QString, QgsAuthOAuth2DefinedConfigsDir>::const_iterator it = sDefinedConfigsDirs.constFind( dirpath );
+    if ( it != sDefinedConfigsDirs.constEnd() && it.value().modified == modified
+         && it.value().signature == signature
+         && it.value().modified.msecsTo( it.value().scanned ) >= MTIME_RESOLUTION_MSECS )
+    {
+      *dirconfigs = it.value();
+      return true;
+    }
+  }
+
+  QgsAuthOAuth2DefinedConfigsDir newconfigs;
+  newconfigs.modified = modified;
+  newconfigs.signature = signature;
+  newconfigs.scanned = QDateTime::currentDateTime();
+
+  // A bundle older than the directory or any config file is stale. Writing the bundle
+  // itself touches the directory too, hence the tolerance there.
+  QFileInfo bundleinfo( QDir( dirpath ).filePath( QgsAuthOAuth2ConfigBundle::bundleFileName() ) );
+  if ( bundleinfo.exists() && bundleinfo.lastModified().msecsTo( dirmodified ) <= MTIME_RESOLUTION_MSECS
+       && !( configsmodified > bundleinfo.lastModified() ) )
+  {
+    QSharedPointer<QgsAuthOAuth2ConfigBundle> bundle( new QgsAuthOAuth2ConfigBundle );
+    if ( bundle->open( bundleinfo.filePath() ) )
+    {
+      newconfigs.bundle = bundle;
+    }
+  }
+  else if ( bundleinfo.exists() )
+  {
+    QgsDebugMsg( QStringLiteral( "Config bundle is out of date, scanning configs instead: %1" ).arg( bundleinfo.filePath() ) );
+  }
+
+  if ( !newconfigs.bundle && summaries )
+  {
+    bool ok = false;
+    newconfigs.configs = QgsAuthOAuth2Config::mapOAuth2ConfigSummaries( dirpath, QStringList(), QgsAuthOAuth2Config::JSON, &ok );
+    if ( !ok )
+    {
+      newconfigs.configs.clear();
+    }
+    *dirconfigs = newconfigs;
+    return true;
+  }
+
+  if ( !newconfigs.bundle )
+  {
+    bool ok = false;
+    newconfigs.configs = QgsAuthOAuth2Config::mapOAuth2ConfigData( dirpath, QgsAuthOAuth2Config::JSON, &ok );
+    if ( !ok )
+    {
+      // nothing usable (e.g. empty dir), but remember that too
+      newconfigs.configs.clear();
+    }
+  }
+
+  QMutexLocker locker( &sDefinedConfigsDirsMutex );
+  sDefinedConfigsDirs.insert( dirpath, newconfigs );
+  *dirconfigs = newconfigs;
+  return true;
+}
 
-  Q_FOREACH ( const QString &configdir, configdirs )
+// Configs of all defined configs directories, later directories overriding earlier ones
+static QMap<QString, QgsAuthOAuth2ConfigData> definedConfigs( const QString &extradir, bool summaries )
+{
+  QMap<QString, QgsAuthOAuth2ConfigData> configs;
+
+  Q_FOREACH ( const QString &configdir, definedConfigsDirs( extradir ) )
   {
-    QFileInfo configdirinfo( configdir );
-    if ( !configdirinfo.exists() || !configdirinfo.isDir() )
+    QgsAuthOAuth2DefinedConfigsDir dirconfigs;
+    if ( !definedConfigsDir( configdir, &dirconfigs, summaries ) )
     {
       continue;
     }
-    QgsStringMap newconfigs = QgsAuthOAuth2Config::mapOAuth2Configs(
-                                configdirinfo.canonicalFilePath(), parent, QgsAuthOAuth2Config::JSON, &ok );
-    if ( ok )
+
+    QMap<QString, QgsAuthOAuth2ConfigData> newconfigs(
+      dirconfigs.bundle ? dirconfigs.bundle->configs() : dirconfigs.configs );
+    QMap<QString, QgsAuthOAuth2ConfigData>::const_iterator i = newconfigs.constBegin();
+    while ( i != newconfigs.constEnd() )
     {
-      QgsStringMap::const_iterator i = newconfigs.constBegin();
-      while ( i != newconfigs.constEnd() )
-      {
-        configs.insert( i.key(), i.value() );
-        ++i;
-      }
+      configs.insert( i.key(), i.value() );
+      ++i;
     }
   }
   return configs;
 }
 
+// static
+QMap<QString, QgsAuthOAuth2ConfigData> QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( QObject *parent, const QString &extradir )
+{
+  Q_UNUSED( parent )
+  return definedConfigs( extradir, false );
+}
+
+// static
+QMap<QString, QgsAuthOAuth2ConfigData> QgsAuthOAuth2Config::mappedOAuth2ConfigSummaries( const QString &extradir )
+{
+  return definedConfigs( extradir, true );
+}
+
+// static
+QgsAuthOAuth2ConfigData QgsAuthOAuth2Config::definedOAuth2Config( const QString &id, const QString &extradir, bool *ok )
+{
+  QStringList configdirs( definedConfigsDirs( extradir ) );
+
+  // most preferred first, so the first match wins
+  for ( int i = configdirs.size() - 1; i >= 0; --i )
+  {
+    QgsAuthOAuth2DefinedConfigsDir dirconfigs;
+    if ( !definedConfigsDir( configdirs.at( i ), &dirconfigs ) )
+    {
+      continue;
+    }
+    if ( dirconfigs.bundle && dirconfigs.bundle->contains( id ) )
+    {
+      return dirconfigs.bundle->config( id, ok );
+    }
+    QMap<QString, QgsAuthOAuth2ConfigData>::const_iterator it = dirconfigs.configs.constFind( id );
+    if ( it != dirconfigs.configs.constEnd() )
+    {
+      if ( ok ) *ok = true;
+      return it.value();
+    }
+  }
+
+  if ( ok ) *ok = false;
+  return QgsAuthOAuth2ConfigData();
+}
+
+// static
+void QgsAuthOAuth2Config::invalidateMappedOAuth2ConfigsCache( const QString &configdirectory )
+{
+  QMutexLocker locker( &sDefinedConfigsDirsMutex );
+  if ( configdirectory.isEmpty() )
+  {
+    sDefinedConfigsDirs.clear();
+    return;
+  }
+  QFileInfo configdirinfo( configdirectory );
+  sDefinedConfigsDirs.remove( configdirinfo.exists() ? configdirinfo.canonicalFilePath() : configdirectory );
+}
+
 // static
 QString QgsAuthOAuth2Config::oauth2ConfigsPkgDataDir()
 {
@@ -816,6 +2079,26 @@ QString QgsAuthOAuth2Config::tokenCacheFile( const QString &suffix )
 // static
 QString QgsAuthOAuth2Config::tokenCachePath( const QString &suffix, bool temporary )
 {
-  return QStringLiteral( "%1/%2" ).arg( QgsAuthOAuth2Config::tokenCacheDirectory( temporary ),
-                                        QgsAuthOAuth2Config::tokenCacheFile( suffix ) );
+  QString cachefile( QgsAuthOAuth2Config::tokenCacheFile( suffix ) );
+  if ( temporary )
+  {
+    // sessions share the temp directory; the owning process tells whether a cache is orphaned
+    cachefile = QgsAuthOAuth2Config::tokenCacheFile(
+                  QStringLiteral( "%1-%2" ).arg( !suffix.isEmpty() ? suffix : QStringLiteral( "cache" ) )
+                  .arg( QCoreApplication::applicationPid() ) );
+  }
+  return QStringLiteral( "%1/%2" ).arg( QgsAuthOAuth2Config::tokenCacheDirectory( temporary ), cachefile );
+}
+
+// static
+bool QgsAuthOAuth2Config::tokenCacheDatabaseEnabled()
+{
+  return QSettings().value( QStringLiteral( "oauth2/tokenCacheDatabase" ), false ).toBool();
+}
+
+// static
+QString QgsAuthOAuth2Config::tokenCacheDatabasePath()
+{
+  QFileInfo authdb( QgsApplication::qgisAuthDatabaseFilePath() );
+  return QStringLiteral( "%1/oauth2-tokens.db" ).arg( authdb.absolutePath() );
 }
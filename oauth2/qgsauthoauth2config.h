@@ -18,6 +18,8 @@
 // TODO: add SimpleCrypt or QgsAuthCrypto for (en|de)crypting client secret key
 
 #include <QObject>
+#include <QSharedDataPointer>
+#include <QStringList>
 #include <QVariantMap>
 
 #include "qgis.h"
@@ -31,6 +33,9 @@
 # define QStringLiteral(str) QString(str)
 #endif
 
+class QgsAuthOAuth2ConfigData;
+class QgsAuthOAuth2ConfigDataPrivate;
+
 
 class QgsAuthOAuth2Config : public QObject
 {
@@ -58,6 +63,7 @@ class QgsAuthOAuth2Config : public QObject
     enum ConfigFormat
     {
       JSON,
+      Binary, //!< Compact, versioned QDataStream encoding
     };
 
     enum AccessMethod
@@ -73,91 +79,101 @@ class QgsAuthOAuth2Config : public QObject
 
     //! Unique ID
     Q_PROPERTY( QString id READ id WRITE setId NOTIFY idChanged )
-    QString id() const { return mId; }
+    QString id() const;
 
     //! Increment this if method is significantly updated, allow updater code to be written
     Q_PROPERTY( int version READ version WRITE setVersion NOTIFY versionChanged )
-    int version() const { return mVersion; }
+    int version() const;
 
     //! Configuration type
     Q_PROPERTY( ConfigType configType READ configType WRITE setConfigType NOTIFY configTypeChanged )
-    ConfigType configType() const { return mConfigType; }
+    ConfigType configType() const;
 
     //! Authorization flow
     Q_PROPERTY( GrantFlow grantFlow READ grantFlow WRITE setGrantFlow NOTIFY grantFlowChanged )
-    GrantFlow grantFlow()  const { return mGrantFlow; }
+    GrantFlow grantFlow() const;
 
     //! Configuration name
     Q_PROPERTY( QString name READ name WRITE setName NOTIFY nameChanged )
-    QString name() const { return mName; }
+    QString name() const;
 
     //! Configuration description
     Q_PROPERTY( QString description READ description WRITE setDescription NOTIFY descriptionChanged )
-    QString description() const { return mDescription; }
+    QString description() const;
 
     //!
     Q_PROPERTY( QString requestUrl READ requestUrl WRITE setRequestUrl NOTIFY requestUrlChanged )
-    QString requestUrl() const { return mRequestUrl; }
+    QString requestUrl() const;
 
     //!
     Q_PROPERTY( QString tokenUrl READ tokenUrl WRITE setTokenUrl NOTIFY tokenUrlChanged )
-    QString tokenUrl() const { return mTokenUrl; }
+    QString tokenUrl() const;
 
     //!
     Q_PROPERTY( QString refreshTokenUrl READ refreshTokenUrl WRITE setRefreshTokenUrl NOTIFY refreshTokenUrlChanged )
-    QString refreshTokenUrl() const { return mRefreshTokenUrl; }
+    QString refreshTokenUrl() const;
 
     //!
     Q_PROPERTY( QString redirectUrl READ redirectUrl WRITE setRedirectUrl NOTIFY redirectUrlChanged )
-    QString redirectUrl() const { return mRedirectURL; }
+    QString redirectUrl() const;
 
     //!
     Q_PROPERTY( int redirectPort READ redirectPort WRITE setRedirectPort NOTIFY redirectPortChanged )
-    int redirectPort() const { return mRedirectPort; }
+    int redirectPort() const;
 
     //!
     Q_PROPERTY( QString clientId READ clientId WRITE setClientId NOTIFY clientIdChanged )
-    QString clientId() const { return mClientId; }
+    QString clientId() const;
 
     //!
     Q_PROPERTY( QString clientSecret READ clientSecret WRITE setClientSecret NOTIFY clientSecretChanged )
-    QString clientSecret() const { return mClientSecret; }
+    QString clientSecret() const;
 
     //! Resource owner username
     Q_PROPERTY( QString username READ username WRITE setUsername NOTIFY usernameChanged )
-    QString username() const { return mUsername; }
+    QString username() const;
 
     //! Resource owner password
     Q_PROPERTY( QString password READ password WRITE setPassword NOTIFY passwordChanged )
-    QString password() const { return mPassword; }
+    QString password() const;
 
     //! Scope of authentication
     Q_PROPERTY( QString scope READ scope WRITE setScope NOTIFY scopeChanged )
-    QString scope() const { return mScope; }
+    QString scope() const;
 
     //! State passed with request
     Q_PROPERTY( QString state READ state WRITE setState NOTIFY stateChanged )
-    QString state() const { return mState; }
+    QString state() const;
 
     //!
     Q_PROPERTY( QString apiKey READ apiKey WRITE setApiKey NOTIFY apiKeyChanged )
-    QString apiKey() const { return mApiKey; }
+    QString apiKey() const;
 
     //!
     Q_PROPERTY( bool persistToken READ persistToken WRITE setPersistToken NOTIFY persistTokenChanged )
-    bool persistToken() const { return mPersistToken; }
+    bool persistToken() const;
 
     //!
     Q_PROPERTY( AccessMethod accessMethod READ accessMethod WRITE setAccessMethod NOTIFY accessMethodChanged )
-    AccessMethod accessMethod() const { return mAccessMethod; }
+    AccessMethod accessMethod() const;
 
     //!
     Q_PROPERTY( int requestTimeout READ requestTimeout WRITE setRequestTimeout NOTIFY requestTimeoutChanged )
-    int requestTimeout() const { return mRequestTimeout; }
+    int requestTimeout() const;
+
+    //! Seconds ahead of token expiry that a background refresh is scheduled
+    Q_PROPERTY( int refreshLeadTime READ refreshLeadTime WRITE setRefreshLeadTime NOTIFY refreshLeadTimeChanged )
+    int refreshLeadTime() const;
 
     //!
     Q_PROPERTY( QVariantMap queryPairs READ queryPairs WRITE setQueryPairs NOTIFY queryPairsChanged )
-    QVariantMap queryPairs() const { return mQueryPairs; }
+    QVariantMap queryPairs() const;
+
+    //! Copy of the config's values, sharing them until either side changes
+    QgsAuthOAuth2ConfigData data() const;
+
+    //! Replace all values of the config, emitting configChanged() once
+    void setData( const QgsAuthOAuth2ConfigData &data );
 
     //! Operator used to compare configs' equality
     bool operator==( const QgsAuthOAuth2Config &other ) const;
@@ -171,6 +187,19 @@ class QgsAuthOAuth2Config : public QObject
     //! @see http://tools.ietf.org/html/rfc6749 for required data per flow
     void validateConfigId( bool needsId = false );
 
+    /**
+     * Start a batch of property changes. Change signals and validation are deferred
+     * until the matching endUpdate(). Batches may be nested.
+     * @see QgsAuthOAuth2ConfigUpdate
+     */
+    void beginUpdate();
+
+    //! End a batch of property changes, emitting configChanged() once if anything changed
+    void endUpdate();
+
+    //! Whether a batch of property changes is in progress
+    bool isUpdating() const { return mUpdateDepth > 0; }
+
     //! Load a string (e.g. JSON) of a config
     bool loadConfigTxt( const QByteArray &configtxt, ConfigFormat format = JSON );
 
@@ -191,6 +220,12 @@ class QgsAuthOAuth2Config : public QObject
         ConfigFormat format = JSON,
         bool *ok = nullptr );
 
+    //! Config text of a stored config map value, unwrapping base64 encoded binary configs
+    static QByteArray configTxtFromStored( const QString &stored, ConfigFormat *format = nullptr );
+
+    //! Config map value to store for config text, base64 encoding binary configs
+    static QString storedFromConfigTxt( const QByteArray &configtxt, ConfigFormat format = JSON );
+
     //! Write config object out to a formatted file (e.g. JSON)
     static bool writeOAuth2Config( const QString &filepath,
                                    QgsAuthOAuth2Config *config,
@@ -211,8 +246,52 @@ class QgsAuthOAuth2Config : public QObject
       ConfigFormat format = JSON,
       bool *ok = nullptr );
 
-    //! Load and parse standard directories of configs (e.g. JSON) to a mapped cache
-    static QgsStringMap mappedOAuth2ConfigsCache( QObject *parent, const QString &extradir = QString::null );
+    //! Load and parse a directory of configs (e.g. JSON) to a map of each config's values
+    static QMap<QString, QgsAuthOAuth2ConfigData> mapOAuth2ConfigData(
+      const QString &configdirectory,
+      ConfigFormat format = JSON,
+      bool *ok = nullptr );
+
+    //! Keys of the config values shown when listing defined configs
+    static QStringList listingKeys();
+
+    /**
+     * Load a directory of configs (e.g. JSON) to a map of partially decoded configs, e.g. for
+     * listing them. Only the given keys, by default listingKeys(), are decoded, and each file is
+     * parsed only up to the last of them. The config ID is always decoded.
+     * @note Configs are not valid, so only for display and not for authentication
+     */
+    static QMap<QString, QgsAuthOAuth2ConfigData> mapOAuth2ConfigSummaries(
+      const QString &configdirectory,
+      const QStringList &keys = QStringList(),
+      ConfigFormat format = JSON,
+      bool *ok = nullptr );
+
+    /**
+     * Load and parse standard directories of configs (e.g. JSON) to a mapped cache of
+     * each config's decoded values, keyed by config ID. Each directory is only
+     * rescanned once its modification time changes.
+     */
+    static QMap<QString, QgsAuthOAuth2ConfigData> mappedOAuth2ConfigsCache( QObject *parent, const QString &extradir = QString::null );
+
+    /**
+     * Configs of the standard directories of configs, as in mappedOAuth2ConfigsCache(), for listing
+     * them. Directories not yet cached are not decoded beyond listingKeys(), nor cached.
+     * @note Configs may not be valid, so only for display and not for authentication
+     */
+    static QMap<QString, QgsAuthOAuth2ConfigData> mappedOAuth2ConfigSummaries( const QString &extradir = QString::null );
+
+    /**
+     * Look up one defined config by ID in the standard directories of configs, as overridden
+     * in mappedOAuth2ConfigsCache(). Directories with a precompiled bundle only decode that config.
+     * @see QgsAuthOAuth2ConfigBundle
+     */
+    static QgsAuthOAuth2ConfigData definedOAuth2Config( const QString &id,
+        const QString &extradir = QString::null,
+        bool *ok = nullptr );
+
+    //! Force a rescan of a directory of configs, or of all directories if empty
+    static void invalidateMappedOAuth2ConfigsCache( const QString &configdirectory = QString::null );
 
     //!
     static QString oauth2ConfigsPkgDataDir();
@@ -235,9 +314,15 @@ class QgsAuthOAuth2Config : public QObject
     //!
     static QString tokenCacheFile( const QString &suffix = QString::null );
 
-    //!
+    //! Path of a token cache file; temporary ones are this session's, named for its process ID too
     static QString tokenCachePath( const QString &suffix = QString::null, bool temporary = false );
 
+    //! Whether token caches are kept in one database instead of a settings file per authcfg
+    static bool tokenCacheDatabaseEnabled();
+
+    //! Path of the token cache database, next to the authentication database
+    static QString tokenCacheDatabasePath();
+
   public slots:
     void setId( const QString &value );
     void setVersion( int value );
@@ -261,6 +346,7 @@ class QgsAuthOAuth2Config : public QObject
     void setPersistToken( bool persist );
     void setAccessMethod( AccessMethod value );
     void setRequestTimeout( int value );
+    void setRefreshLeadTime( int value );
     void setQueryPairs( const QVariantMap &pairs );
 
     void setToDefaults();
@@ -292,34 +378,142 @@ class QgsAuthOAuth2Config : public QObject
     void persistTokenChanged( bool );
     void accessMethodChanged( AccessMethod );
     void requestTimeoutChanged( int );
+    void refreshLeadTimeChanged( int );
     void queryPairsChanged( const QVariantMap & );
 
     void validityChanged( bool );
 
   private:
-    QString mId;
-    int mVersion;
-    ConfigType mConfigType;
-    GrantFlow mGrantFlow;
-    QString mName;
-    QString mDescription;
-    QString mRequestUrl;
-    QString mTokenUrl;
-    QString mRefreshTokenUrl;
-    QString mRedirectURL;
-    int mRedirectPort;
-    QString mClientId;
-    QString mClientSecret;
-    QString mUsername;
-    QString mPassword;
-    QString mScope;
-    QString mState;
-    QString mApiKey;
-    bool mPersistToken;
-    AccessMethod mAccessMethod;
-    int mRequestTimeout; // in seconds
-    QVariantMap mQueryPairs;
+    //! Whether a change should be signalled now, otherwise it is recorded for endUpdate()
+    bool notifyChange();
+
+    QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate> d;
     bool mValid;
+    int mUpdateDepth;
+    bool mUpdatePending;
+};
+
+/**
+ * Implicitly shared values of an OAuth2 config, cheap to copy and safe to pass between
+ * threads. Used for cached and hot path configs; QgsAuthOAuth2Config wraps it for the GUI.
+ */
+class QgsAuthOAuth2ConfigData
+{
+  public:
+    QgsAuthOAuth2ConfigData();
+    QgsAuthOAuth2ConfigData( const QgsAuthOAuth2ConfigData &other );
+    ~QgsAuthOAuth2ConfigData();
+
+    QgsAuthOAuth2ConfigData &operator=( const QgsAuthOAuth2ConfigData &other );
+
+    //! Compares all values except the ID, as QgsAuthOAuth2Config does
+    bool operator==( const QgsAuthOAuth2ConfigData &other ) const;
+
+    bool operator!=( const QgsAuthOAuth2ConfigData &other ) const;
+
+    //! @see QgsAuthOAuth2Config::validateConfigId()
+    bool isValid( bool needsId = false ) const;
+
+    QString id() const;
+    void setId( const QString &value );
+    int version() const;
+    void setVersion( int value );
+    QgsAuthOAuth2Config::ConfigType configType() const;
+    void setConfigType( QgsAuthOAuth2Config::ConfigType value );
+    QgsAuthOAuth2Config::GrantFlow grantFlow() const;
+    void setGrantFlow( QgsAuthOAuth2Config::GrantFlow value );
+    QString name() const;
+    void setName( const QString &value );
+    QString description() const;
+    void setDescription( const QString &value );
+    QString requestUrl() const;
+    void setRequestUrl( const QString &value );
+    QString tokenUrl() const;
+    void setTokenUrl( const QString &value );
+    QString refreshTokenUrl() const;
+    void setRefreshTokenUrl( const QString &value );
+    QString redirectUrl() const;
+    void setRedirectUrl( const QString &value );
+    int redirectPort() const;
+    void setRedirectPort( int value );
+    QString clientId() const;
+    void setClientId( const QString &value );
+    QString clientSecret() const;
+    void setClientSecret( const QString &value );
+    QString username() const;
+    void setUsername( const QString &value );
+    QString password() const;
+    void setPassword( const QString &value );
+    QString scope() const;
+    void setScope( const QString &value );
+    QString state() const;
+    void setState( const QString &value );
+    QString apiKey() const;
+    void setApiKey( const QString &value );
+    bool persistToken() const;
+    void setPersistToken( bool value );
+    QgsAuthOAuth2Config::AccessMethod accessMethod() const;
+    void setAccessMethod( QgsAuthOAuth2Config::AccessMethod value );
+    int requestTimeout() const;
+    void setRequestTimeout( int value );
+    int refreshLeadTime() const;
+    void setRefreshLeadTime( int value );
+    QVariantMap queryPairs() const;
+    void setQueryPairs( const QVariantMap &value );
+
+    //! Properties keyed as serialized, e.g. for JSON
+    QVariantMap mappedProperties() const;
+
+    //! Decode serialized properties, skipping unknown keys; returns whether any value changed
+    bool loadMappedProperties( const QVariantMap &properties );
+
+    //! Serialize all values, e.g. to JSON or the compact binary format
+    QByteArray serialized( QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::JSON,
+                           bool pretty = false, bool *ok = nullptr ) const;
+
+    //! Replace all values with a serialized config; on failure values are left unchanged
+    bool loadSerialized( const QByteArray &serial,
+                         QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::JSON );
+
+    /**
+     * Replace values with only some keys of a serialized config, leaving others at their
+     * defaults, e.g. for listing. JSON text is parsed only up to the last of the keys.
+     * With no keys, or for other formats, the whole config is loaded.
+     */
+    bool loadSerializedKeys( const QByteArray &serial,
+                             const QStringList &keys,
+                             QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::JSON );
+
+  private:
+    friend class QgsAuthOAuth2Config;
+
+    explicit QgsAuthOAuth2ConfigData( const QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate> &data );
+
+    QSharedDataPointer<QgsAuthOAuth2ConfigDataPrivate> d;
+};
+
+/**
+ * Scoped batch of property changes on a QgsAuthOAuth2Config, so that configChanged()
+ * and validityChanged() are emitted at most once when the guard goes out of scope.
+ */
+class QgsAuthOAuth2ConfigUpdate
+{
+  public:
+    explicit QgsAuthOAuth2ConfigUpdate( QgsAuthOAuth2Config *config )
+      : mConfig( config )
+    {
+      if ( mConfig ) mConfig->beginUpdate();
+    }
+
+    ~QgsAuthOAuth2ConfigUpdate()
+    {
+      if ( mConfig ) mConfig->endUpdate();
+    }
+
+  private:
+    Q_DISABLE_COPY( QgsAuthOAuth2ConfigUpdate )
+
+    QgsAuthOAuth2Config *mConfig;
 };
 
 #endif // QGSAUTHOAUTH2CONFIG_H
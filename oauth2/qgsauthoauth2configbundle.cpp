@@ -0,0 +1,279 @@
+/***************************************************************************
+    begin                : October 16, 2026
+    copyright            : (C) 2026 by Boundless Spatial, Inc. USA
+    author               : Larry Shaffer
+    email                : lshaffer at boundlessgeo dot com
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgsauthoauth2configbundle.h"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDir>
+
+#include "qgslogger.h"
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <stdio.h>
+#endif
+
+
+// Bundle files are a magic number, format version and config count, then the index of
+// (ID, offset, size) entries, then the binary encoded configs the offsets point into
+static const quint32 BUNDLE_MAGIC = 0x4f413242; // "OA2B", big endian
+static const quint8 BUNDLE_VERSION = 1;
+
+
+QgsAuthOAuth2ConfigBundle::QgsAuthOAuth2ConfigBundle()
+  : mData( nullptr )
+  , mMapped( false )
+  , mSize( 0 )
+  , mConfigsOffset( 0 )
+{
+}
+
+QgsAuthOAuth2ConfigBundle::~QgsAuthOAuth2ConfigBundle()
+{
+  close();
+}
+
+// static
+QString QgsAuthOAuth2ConfigBundle::bundleFileName()
+{
+  return QStringLiteral( "oauth2configs.bundle" );
+}
+
+// static
+bool QgsAuthOAuth2ConfigBundle::writeBundle( const QMap<QString, QgsAuthOAuth2ConfigData> &configs,
+    const QString &bundlepath,
+    QString *error )
+{
+  QByteArray index;
+  QByteArray encoded;
+  QDataStream indexstream( &index, QIODevice::WriteOnly );
+  indexstream.setVersion( QDataStream::Qt_4_8 );
+  indexstream << BUNDLE_MAGIC << BUNDLE_VERSION << static_cast<quint32>( configs.size() );
+
+  QMap<QString, QgsAuthOAuth2ConfigData>::const_iterator it = configs.constBegin();
+  for ( ; it != configs.constEnd(); ++it )
+  {
+    bool ok = false;
+    QByteArray config = it.value().serialized( QgsAuthOAuth2Config::Binary, false, &ok );
+    if ( !ok )
+    {
+      if ( error ) *error = QStringLiteral( "Failed to encode config: %1" ).arg( it.key() );
+      return false;
+    }
+    indexstream << it.key() << static_cast<quint32>( encoded.size() ) << static_cast<quint32>( config.size() );
+    encoded.append( config );
+  }
+
+  // write beside the bundle, then swap it in, so readers never see a partial file
+  QString tmppath( bundlepath + QStringLiteral( ".tmp" ) );
+  QFile tmpfile( tmppath );
+  if ( !tmpfile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+  {
+    if ( error ) *error = QStringLiteral( "Failed to open for writing: %1" ).arg( tmppath );
+    return false;
+  }
+  bool written = ( tmpfile.write( index ) == index.size() && tmpfile.write( encoded ) == encoded.size() );
+  written = tmpfile.flush() && written;
+  tmpfile.close();
+  if ( !written )
+  {
+    if ( error ) *error = QStringLiteral( "Failed to write: %1" ).arg( tmppath );
+    tmpfile.remove();
+    return false;
+  }
+
+  // QFile::rename() does not overwrite, and removing the bundle first would leave readers
+  // without one meanwhile; these replace it in one step, on the same file system
+#ifdef Q_OS_WIN
+  bool replaced = MoveFileExW( reinterpret_cast<const wchar_t *>( QDir::toNativeSeparators( tmppath ).utf16() ),
+                               reinterpret_cast<const wchar_t *>( QDir::toNativeSeparators( bundlepath ).utf16() ),
+                               MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+  bool replaced = ::rename( QFile::encodeName( tmppath ).constData(), QFile::encodeName( bundlepath ).constData() ) == 0;
+#endif
+  if ( !replaced )
+  {
+    // e.g. on Windows, while the bundle is open
+    if ( error ) *error = QStringLiteral( "Failed to replace: %1" ).arg( bundlepath );
+    tmpfile.remove();
+    return false;
+  }
+  return true;
+}
+
+// static
+bool QgsAuthOAuth2ConfigBundle::compileDirectory( const QString &configdirectory,
+    const QString &bundlepath,
+    QgsAuthOAuth2Config::ConfigFormat format,
+    QString *error )
+{
+  bool ok = false;
+  QMap<QString, QgsAuthOAuth2ConfigData> configs =
+    QgsAuthOAuth2Config::mapOAuth2ConfigData( configdirectory, format, &ok );
+  if ( !ok )
+  {
+    if ( error ) *error = QStringLiteral( "No configs loaded from: %1" ).arg( configdirectory );
+    return false;
+  }
+
+  QString path( bundlepath );
+  if ( path.isEmpty() )
+  {
+    path = QDir( configdirectory ).filePath( bundleFileName() );
+  }
+  return writeBundle( configs, path, error );
+}
+
+bool QgsAuthOAuth2ConfigBundle::open( const QString &bundlepath )
+{
+  close();
+
+  mFile.setFileName( bundlepath );
+  if ( !mFile.open( QIODevice::ReadOnly ) )
+  {
+    QgsDebugMsg( QStringLiteral( "FAILED to open config bundle: %1" ).arg( bundlepath ) );
+    return false;
+  }
+
+  mSize = mFile.size();
+  mData = mFile.map( 0, mSize );
+  mMapped = ( mData != nullptr );
+  if ( !mMapped )
+  {
+    // e.g. unsupported by the file system
+    mBuffer = mFile.readAll();
+    mData = reinterpret_cast<const uchar *>( mBuffer.constData() );
+  }
+
+  if ( !readIndex() )
+  {
+    QgsDebugMsg( QStringLiteral( "FAILED to read config bundle index: %1" ).arg( bundlepath ) );
+    close();
+    return false;
+  }
+  return true;
+}
+
+void QgsAuthOAuth2ConfigBundle::close()
+{
+  if ( mMapped )
+  {
+    mFile.unmap( const_cast<uchar *>( mData ) );
+  }
+  mData = nullptr;
+  mMapped = false;
+  mSize = 0;
+  mBuffer.clear();
+  mConfigsOffset = 0;
+  mIndex.clear();
+  if ( mFile.isOpen() )
+  {
+    mFile.close();
+  }
+}
+
+bool QgsAuthOAuth2ConfigBundle::readIndex()
+{
+  QByteArray raw( QByteArray::fromRawData( reinterpret_cast<const char *>( mData ), static_cast<int>( mSize ) ) );
+  QBuffer buffer( &raw );
+  buffer.open( QIODevice::ReadOnly );
+  QDataStream stream( &buffer );
+  stream.setVersion( QDataStream::Qt_4_8 );
+
+  quint32 magic = 0;
+  quint8 version = 0;
+  quint32 count = 0;
+  stream >> magic >> version >> count;
+  if ( stream.status() != QDataStream::Ok || magic != BUNDLE_MAGIC )
+  {
+    QgsDebugMsg( QStringLiteral( "Not an OAuth2 config bundle" ) );
+    return false;
+  }
+  if ( version == 0 || version > BUNDLE_VERSION )
+  {
+    QgsDebugMsg( QStringLiteral( "Unsupported OAuth2 config bundle version: %1" ).arg( version ) );
+    return false;
+  }
+
+  if ( count > static_cast<quint64>( mSize ) )
+  {
+    return false;
+  }
+  mIndex.reserve( static_cast<int>( count ) );
+  for ( quint32 i = 0; i < count; ++i )
+  {
+    QString id;
+    quint32 offset = 0;
+    quint32 size = 0;
+    stream >> id >> offset >> size;
+    if ( stream.status() != QDataStream::Ok )
+    {
+      return false;
+    }
+    mIndex.insert( id, qMakePair( offset, size ) );
+  }
+  mConfigsOffset = buffer.pos();
+
+  // reject offsets past the end here, rather than on each lookup
+  QHash<QString, QPair<quint32, quint32> >::const_iterator it = mIndex.constBegin();
+  for ( ; it != mIndex.constEnd(); ++it )
+  {
+    if ( mConfigsOffset + it.value().first + it.value().second > mSize )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+QgsAuthOAuth2ConfigData QgsAuthOAuth2ConfigBundle::config( const QString &id, bool *ok ) const
+{
+  QgsAuthOAuth2ConfigData data;
+  bool res = false;
+
+  QHash<QString, QPair<quint32, quint32> >::const_iterator it = mIndex.constFind( id );
+  if ( it != mIndex.constEnd() )
+  {
+    // decoding copies the values out, so the mapped bytes are not copied first
+    QByteArray encoded( QByteArray::fromRawData(
+                          reinterpret_cast<const char *>( mData + mConfigsOffset + it.value().first ),
+                          static_cast<int>( it.value().second ) ) );
+    res = data.loadSerialized( encoded, QgsAuthOAuth2Config::Binary );
+    if ( !res )
+    {
+      QgsDebugMsg( QStringLiteral( "FAILED to decode bundled config: %1" ).arg( id ) );
+    }
+  }
+
+  if ( ok ) *ok = res;
+  return data;
+}
+
+QMap<QString, QgsAuthOAuth2ConfigData> QgsAuthOAuth2ConfigBundle::configs() const
+{
+  QMap<QString, QgsAuthOAuth2ConfigData> configs;
+  QHash<QString, QPair<quint32, quint32> >::const_iterator it = mIndex.constBegin();
+  for ( ; it != mIndex.constEnd(); ++it )
+  {
+    bool ok = false;
+    QgsAuthOAuth2ConfigData data = config( it.key(), &ok );
+    if ( ok )
+    {
+      configs.insert( it.key(), data );
+    }
+  }
+  return configs;
+}
@@ -0,0 +1,99 @@
+/***************************************************************************
+    begin                : October 16, 2026
+    copyright            : (C) 2026 by Boundless Spatial, Inc. USA
+    author               : Larry Shaffer
+    email                : lshaffer at boundlessgeo dot com
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSAUTHOAUTH2CONFIGBUNDLE_H
+#define QGSAUTHOAUTH2CONFIGBUNDLE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+
+#include "qgsauthoauth2config.h"
+
+
+/**
+ * A directory of defined configs, precompiled into one indexed file.
+ *
+ * The file holds an index of config IDs to offsets, followed by each config in the
+ * binary config format. It is memory mapped when opened and only the index is read,
+ * so configs are decoded on demand and looking one up does not depend on the number
+ * of configs in the bundle.
+ */
+class QgsAuthOAuth2ConfigBundle
+{
+  public:
+    QgsAuthOAuth2ConfigBundle();
+
+    ~QgsAuthOAuth2ConfigBundle();
+
+    //! File name of a bundle placed in a defined configs directory
+    static QString bundleFileName();
+
+    //! Write configs, keyed by ID, to a bundle file; replaces any existing file atomically
+    static bool writeBundle( const QMap<QString, QgsAuthOAuth2ConfigData> &configs,
+                             const QString &bundlepath,
+                             QString *error = nullptr );
+
+    /**
+     * Compile a directory of configs (e.g. JSON) to a bundle file, by default the directory's
+     * own bundleFileName(). The bundle must be recompiled when configs in it are edited.
+     */
+    static bool compileDirectory( const QString &configdirectory,
+                                  const QString &bundlepath = QString::null,
+                                  QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::JSON,
+                                  QString *error = nullptr );
+
+    //! Open and index a bundle file, closing any already open
+    bool open( const QString &bundlepath );
+
+    //! Release the bundle file
+    void close();
+
+    bool isOpen() const { return mData != nullptr; }
+
+    //! Number of configs in the bundle
+    int count() const { return mIndex.size(); }
+
+    //! IDs of configs in the bundle
+    QStringList ids() const { return mIndex.keys(); }
+
+    //! Whether a config with this ID is in the bundle
+    bool contains( const QString &id ) const { return mIndex.contains( id ); }
+
+    //! Decode one config, e.g. when resolving a defined ID
+    QgsAuthOAuth2ConfigData config( const QString &id, bool *ok = nullptr ) const;
+
+    //! Decode all configs, keyed by ID, e.g. for listing
+    QMap<QString, QgsAuthOAuth2ConfigData> configs() const;
+
+  private:
+    Q_DISABLE_COPY( QgsAuthOAuth2ConfigBundle )
+
+    bool readIndex();
+
+    QFile mFile;
+    // mapped file, or mBuffer's data where mapping is unsupported
+    const uchar *mData;
+    bool mMapped;
+    qint64 mSize;
+    QByteArray mBuffer;
+    qint64 mConfigsOffset;
+    // config ID -> offset and size of its encoded config, relative to mConfigsOffset
+    QHash<QString, QPair<quint32, quint32> > mIndex;
+};
+
+#endif // QGSAUTHOAUTH2CONFIGBUNDLE_H
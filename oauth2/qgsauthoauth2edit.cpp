@@ -23,12 +23,15 @@
 #include "qgsauthmanager.h"
 #include "qgsauthconfigedit.h"
 #include "qgslogger.h"
+#include "qgsauthoauth2method.h"
+#include "qgso2.h"
+#include "qgso2tokendatabase.h"
 
 
 QgsAuthOAuth2Edit::QgsAuthOAuth2Edit( QWidget *parent )
   : QgsAuthMethodEdit( parent )
   , mOAuthConfigCustom( nullptr )
-  , mDefinedConfigsCache( QgsStringMap() )
+  , mDefinedConfigsCache( QMap<QString, QgsAuthOAuth2ConfigData>() )
   , mParentName( nullptr )
   , mValid( false )
   , mCurTab( 0 )
@@ -205,6 +208,8 @@ void QgsAuthOAuth2Edit::setupConnections()
            this, SLOT( updateConfigAccessMethod( int ) ) );
   connect( spnbxRequestTimeout, SIGNAL( valueChanged( int ) ),
            mOAuthConfigCustom, SLOT( setRequestTimeout( int ) ) );
+  connect( spnbxRefreshLeadTime, SIGNAL( valueChanged( int ) ),
+           mOAuthConfigCustom, SLOT( setRefreshLeadTime( int ) ) );
 
   connect( mOAuthConfigCustom, SIGNAL( validityChanged( bool ) ),
            this, SLOT( configValidityChanged() ) );
@@ -253,6 +258,8 @@ void QgsAuthOAuth2Edit::setupConnections()
            this, &QgsAuthOAuth2Edit::updateConfigAccessMethod );
   connect( spnbxRequestTimeout, static_cast<void ( QSpinBox::* )( int )>( &QSpinBox::valueChanged ),
            mOAuthConfigCustom, &QgsAuthOAuth2Config::setRequestTimeout );
+  connect( spnbxRefreshLeadTime, static_cast<void ( QSpinBox::* )( int )>( &QSpinBox::valueChanged ),
+           mOAuthConfigCustom, &QgsAuthOAuth2Config::setRefreshLeadTime );
 
   connect( mOAuthConfigCustom, &QgsAuthOAuth2Config::validityChanged, this, &QgsAuthOAuth2Edit::configValidityChanged );
 
@@ -297,7 +304,10 @@ QgsStringMap QgsAuthOAuth2Edit::configMap() const
 
     mOAuthConfigCustom->setQueryPairs( queryPairs() );
 
-    QByteArray configtxt = mOAuthConfigCustom->saveConfigTxt( QgsAuthOAuth2Config::JSON, false, &ok );
+    // binary configs load faster, but plugin versions before the format only read JSON
+    QgsAuthOAuth2Config::ConfigFormat format = QSettings().value( QStringLiteral( "oauth2/storeBinaryConfigs" ), false ).toBool()
+        ? QgsAuthOAuth2Config::Binary : QgsAuthOAuth2Config::JSON;
+    QByteArray configtxt = mOAuthConfigCustom->saveConfigTxt( format, false, &ok );
 
     if ( !ok )
     {
@@ -315,7 +325,7 @@ QgsStringMap QgsAuthOAuth2Edit::configMap() const
     //QgsDebugMsg( QStringLiteral( "SAVE oauth2config configtxt: \n\n%1\n\n" ).arg( QString( configtxt ) ) );
     //###################### DO NOT LEAVE ME UNCOMMENTED #####################
 
-    configmap.insert( QStringLiteral( "oauth2config" ), QString( configtxt ) );
+    configmap.insert( QStringLiteral( "oauth2config" ), QgsAuthOAuth2Config::storedFromConfigTxt( configtxt, format ) );
 
     updateTokenCacheFile( mOAuthConfigCustom->persistToken() );
   }
@@ -343,14 +353,15 @@ void QgsAuthOAuth2Edit::loadConfig( const QgsStringMap &configmap )
   if ( configmap.contains( QStringLiteral( "oauth2config" ) ) )
   {
     tabConfigs->setCurrentIndex( customTab() );
-    QByteArray configtxt = configmap.value( QStringLiteral( "oauth2config" ) ).toUtf8();
+    QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::JSON;
+    QByteArray configtxt = QgsAuthOAuth2Config::configTxtFromStored( configmap.value( QStringLiteral( "oauth2config" ) ), &format );
     if ( !configtxt.isEmpty() )
     {
       //###################### DO NOT LEAVE ME UNCOMMENTED #####################
       //QgsDebugMsg( QStringLiteral( "LOAD oauth2config configtxt: \n\n%1\n\n" ).arg( QString( configtxt ) ) );
       //###################### DO NOT LEAVE ME UNCOMMENTED #####################
 
-      if ( !mOAuthConfigCustom->loadConfigTxt( configtxt, QgsAuthOAuth2Config::JSON ) )
+      if ( !mOAuthConfigCustom->loadConfigTxt( configtxt, format ) )
       {
         QgsDebugMsg( QStringLiteral( "FAILED to load OAuth2 config into object" ) );
       }
@@ -451,6 +462,9 @@ void QgsAuthOAuth2Edit::loadFromOAuthConfig( const QgsAuthOAuth2Config *config )
   // load relative to config type
   if ( config->configType() == QgsAuthOAuth2Config::Custom )
   {
+    // widgets write back to the custom config, so validate it once rather than per field
+    QgsAuthOAuth2ConfigUpdate update( mOAuthConfigCustom );
+
     if ( config->isValid() )
     {
       tabConfigs->setCurrentIndex( customTab() );
@@ -473,6 +487,7 @@ void QgsAuthOAuth2Edit::loadFromOAuthConfig( const QgsAuthOAuth2Config *config )
     chkbxTokenPersist->setChecked( config->persistToken() );
     cmbbxAccessMethod->setCurrentIndex( static_cast<int>( config->accessMethod() ) );
     spnbxRequestTimeout->setValue( config->requestTimeout() );
+    spnbxRefreshLeadTime->setValue( config->refreshLeadTime() );
 
     populateQueryPairs( config->queryPairs() );
 
@@ -503,50 +518,15 @@ void QgsAuthOAuth2Edit::updateTokenCacheFile( bool curpersist ) const
     return;
   }
 
-  QString localcachefile = QgsAuthOAuth2Config::tokenCachePath( authcfg, false );
-
-  QString tempcachefile = QgsAuthOAuth2Config::tokenCachePath( authcfg, true );
-
-  //QgsDebugMsg( QStringLiteral( "localcachefile: %1" ).arg( localcachefile ) );
-  //QgsDebugMsg( QStringLiteral( "tempcachefile: %1" ).arg( tempcachefile ) );
-
-  if ( curpersist )
+  // a live authenticator for the authcfg keeps its tokens and moves along with its cache,
+  // rather than racing a copy of the cache file it may be writing
+  QgsAuthOAuth2Method *method = qobject_cast<QgsAuthOAuth2Method *>(
+                                  QgsAuthManager::instance()->authMethod( QStringLiteral( "OAuth2" ) ) );
+  bool moved = ( method ? method->migrateTokenCache( authcfg, curpersist )
+                 : QgsO2::moveTokenCache( authcfg, curpersist ) );
+  if ( !moved )
   {
-    // move cache file from temp dir to local
-    if ( QFile::exists( localcachefile ) && !QFile::remove( localcachefile ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to delete local token cache file: %1" ).arg( localcachefile ) );
-      return;
-    }
-    if ( QFile::exists( tempcachefile ) && !QFile::copy( tempcachefile, localcachefile ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to copy temp to local token cache file: %1 -> %2" ).arg( tempcachefile, localcachefile ) );
-      return;
-    }
-    if ( QFile::exists( tempcachefile ) && !QFile::remove( tempcachefile ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to delete temp token cache file after copy: %1" ).arg( tempcachefile ) );
-      return;
-    }
-  }
-  else
-  {
-    // move cache file from local to temp
-    if ( QFile::exists( tempcachefile ) && !QFile::remove( tempcachefile ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to delete temp token cache file: %1" ).arg( tempcachefile ) );
-      return;
-    }
-    if ( QFile::exists( localcachefile ) && !QFile::copy( localcachefile, tempcachefile ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to copy local to temp token cache file: %1 -> %2" ).arg( localcachefile, tempcachefile ) );
-      return;
-    }
-    if ( QFile::exists( localcachefile ) && !QFile::remove( localcachefile ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to delete temp token cache file after copy: %1" ).arg( localcachefile ) );
-      return;
-    }
+    QgsDebugMsg( QStringLiteral( "FAILED to move token cache for authcfg: %1" ).arg( authcfg ) );
   }
 }
 
@@ -578,6 +558,8 @@ void QgsAuthOAuth2Edit::definedCustomDirChanged( const QString &path )
 
   if ( ok )
   {
+    // the user may be pointing at the directory again after editing its configs
+    QgsAuthOAuth2Config::invalidateMappedOAuth2ConfigsCache( path );
     loadDefinedConfigs();
   }
 }
@@ -667,6 +649,12 @@ bool QgsAuthOAuth2Edit::hasTokenCacheFile()
     return false;
   }
 
+  if ( QgsAuthOAuth2Config::tokenCacheDatabaseEnabled() )
+  {
+    QgsO2TokenDatabase tokendb;
+    return tokendb.hasTokens( authcfg, false ) || tokendb.hasTokens( authcfg, true );
+  }
+
   return ( QFile::exists( QgsAuthOAuth2Config::tokenCachePath( authcfg, false ) )
            || QFile::exists( QgsAuthOAuth2Config::tokenCachePath( authcfg, true ) ) );
 }
@@ -681,6 +669,15 @@ void QgsAuthOAuth2Edit::removeTokenCacheFile()
     return;
   }
 
+  if ( QgsAuthOAuth2Config::tokenCacheDatabaseEnabled() )
+  {
+    QgsO2TokenDatabase tokendb;
+    if ( !tokendb.removeTokens( authcfg, false ) || !tokendb.removeTokens( authcfg, true ) )
+    {
+      QgsDebugMsg( QStringLiteral( "Remove tokens from token database FAILED for authcfg %1" ).arg( authcfg ) );
+    }
+  }
+
   QStringList cachefiles;
   cachefiles << QgsAuthOAuth2Config::tokenCachePath( authcfg, false )
              << QgsAuthOAuth2Config::tokenCachePath( authcfg, true );
@@ -700,7 +697,8 @@ void QgsAuthOAuth2Edit::updateDefinedConfigsCache()
 {
   QString extradir = leDefinedDirPath->text();
   mDefinedConfigsCache.clear();
-  mDefinedConfigsCache = QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( this, extradir );
+  // only listed, so configs not already cached are not decoded beyond what is shown
+  mDefinedConfigsCache = QgsAuthOAuth2Config::mappedOAuth2ConfigSummaries( extradir );
 }
 
 // slot
@@ -712,24 +710,19 @@ void QgsAuthOAuth2Edit::loadDefinedConfigs()
 
   updateDefinedConfigsCache();
 
-  QgsStringMap::const_iterator i = mDefinedConfigsCache.constBegin();
-  while ( i != mDefinedConfigsCache.constEnd() )
+  // configs are already decoded, so no config objects are needed for listing
+  QMap<QString, QgsAuthOAuth2ConfigData>::const_iterator i = mDefinedConfigsCache.constBegin();
+  for ( ; i != mDefinedConfigsCache.constEnd(); ++i )
   {
-    QgsAuthOAuth2Config *config = new QgsAuthOAuth2Config( this );
-    if ( !config->loadConfigTxt( i.value().toUtf8(), QgsAuthOAuth2Config::JSON ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to load config for ID: %1" ).arg( i.key() ) );
-      config->deleteLater();
-      continue;
-    }
-
-    QString grantflow = QgsAuthOAuth2Config::grantFlowString( config->grantFlow() );
+    const QgsAuthOAuth2ConfigData &config = i.value();
+    QString grantflow = QgsAuthOAuth2Config::grantFlowString( config.grantFlow() );
+    QString description = config.description();
 
     QString name = QStringLiteral( "%1 (%2): %3" )
-                   .arg( config->name(), grantflow, config->description() );
+                   .arg( config.name(), grantflow, description );
 
     QString tip = tr( "ID: %1\nGrant flow: %2\nDescription: %3" )
-                  .arg( i.key(), grantflow, config->description() );
+                  .arg( i.key(), grantflow, description );
 
     QListWidgetItem *itm = new QListWidgetItem( lstwdgDefinedConfigs );
     itm->setText( name );
@@ -737,9 +730,6 @@ void QgsAuthOAuth2Edit::loadDefinedConfigs()
     itm->setData( Qt::UserRole, QVariant( i.key() ) );
     itm->setData( Qt::ToolTipRole, QVariant( tip ) );
     lstwdgDefinedConfigs->addItem( itm );
-
-    config->deleteLater();
-    ++i;
   }
 
   if ( lstwdgDefinedConfigs->count() == 0 )
@@ -828,6 +818,8 @@ void QgsAuthOAuth2Edit::exportOAuthConfig()
   }
   settings.setValue( QStringLiteral( "UI/lastAuthSaveFileDir" ), QFileInfo( configpath ).absoluteDir().path() );
 
+  QgsAuthOAuth2ConfigUpdate update( mOAuthConfigCustom );
+
   // give it a kind of random id for re-importing
   mOAuthConfigCustom->setId( QgsAuthManager::instance()->uniqueConfigId() );
 
@@ -106,7 +106,7 @@ class QgsAuthOAuth2Edit : public QgsAuthMethodEdit, private Ui::QgsAuthOAuth2Edi
     QString currentDefinedConfig() const { return mDefinedId; }
 
     QgsAuthOAuth2Config *mOAuthConfigCustom;
-    QgsStringMap mDefinedConfigsCache;
+    QMap<QString, QgsAuthOAuth2ConfigData> mDefinedConfigsCache;
     QString mDefinedId;
     QLineEdit *mParentName;
     QgsStringMap mConfigMap;
@@ -21,30 +21,198 @@
 #include "qgsapplication.h"
 #include "qgsauthmanager.h"
 #include "qgso2.h"
+#include "qgso2tokendatabase.h"
+#include "qgso2tokenstore.h"
 #include "qgsauthoauth2config.h"
 #include "qgsauthoauth2edit.h"
 #include "qgsnetworkaccessmanager.h"
 #include "qgslogger.h"
 #include "qgsmessagelog.h"
 
+#include <QCoreApplication>
 #include <QDateTime>
 #include <QDesktopServices>
 #include <QDir>
 #include <QEventLoop>
-#include <QSettings>
+#include <QFileInfo>
 #include <QString>
 #include <QMutexLocker>
+#include <QReadLocker>
+#include <QScopedPointer>
+#include <QSettings>
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QWriteLocker>
+
+#include <limits>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#endif
 
 
 static const QString AUTH_METHOD_KEY = QStringLiteral( "OAuth2" );
 static const QString AUTH_METHOD_DESCRIPTION = QStringLiteral( "OAuth2 authentication" );
 
-QMap<QString, QgsO2 * > QgsAuthOAuth2Method::sOAuth2ConfigCache =
-  QMap<QString, QgsO2 * >();
+// try refresh with expired tokens or ones with less than this many seconds to go
+static const int TOKEN_EXPIRY_WINDOW = 120;
+
+static bool tokenExpiring( int expires )
+{
+  if ( expires <= 0 )  // QStringLiteral("").toInt() result for tokens with no expiration
+  {
+    return false;
+  }
+  int cursecs = static_cast<int>( QDateTime::currentDateTime().toMSecsSinceEpoch() / 1000 );
+  return ( ( expires - cursecs ) < TOKEN_EXPIRY_WINDOW );
+}
+
+static const QByteArray AUTHORIZATION_HEADER( O2_HTTP_AUTHORIZATION_HEADER );
+static const QByteArray ACCESS_TOKEN_ITEM( O2_OAUTH2_ACCESS_TOKEN );
+
+// whether an encoded query already has an access token item
+static bool hasAccessTokenItem( const QByteArray &query )
+{
+  int from = 0;
+  while ( ( from = query.indexOf( ACCESS_TOKEN_ITEM, from ) ) != -1 )
+  {
+    int end = from + ACCESS_TOKEN_ITEM.size();
+    if ( ( from == 0 || query.at( from - 1 ) == '&' )
+         && ( end == query.size() || query.at( end ) == '=' || query.at( end ) == '&' ) )
+    {
+      return true;
+    }
+    from = end;
+  }
+  return false;
+}
+
+// seconds between aggregated request summaries in the message log
+static const int LOG_SUMMARY_INTERVAL = 10;
+
+// seconds between sweeps of the bundle cache for idle bundles
+static const int BUNDLE_SWEEP_INTERVAL = 60;
+
+// whether a process, e.g. the session owning a temporary token cache, is still running
+static bool processIsRunning( qint64 pid )
+{
+#ifdef Q_OS_WIN
+  HANDLE process = OpenProcess( SYNCHRONIZE, FALSE, static_cast<DWORD>( pid ) );
+  if ( !process )
+  {
+    // denied access means it exists
+    return GetLastError() == ERROR_ACCESS_DENIED;
+  }
+  bool running = WaitForSingleObject( process, 0 ) == WAIT_TIMEOUT;
+  CloseHandle( process );
+  return running;
+#else
+  // signal 0 only checks the process exists, and may be denied if it is another user's
+  return ::kill( static_cast<pid_t>( pid ), 0 ) == 0 || errno == EPERM;
+#endif
+}
+
+// runs QgsAuthOAuth2Method::removeStaleTokenCaches() on a pool thread
+class TokenCacheCollector
+{
+  public:
+    typedef int result_type;
+
+    int operator()() const
+    {
+      return QgsAuthOAuth2Method::removeStaleTokenCaches( tempDirPath, persistentDirPath, databasePath,
+             configIds, liveAuthcfgs, maxAge );
+    }
+
+    QString tempDirPath;
+    QString persistentDirPath;
+    QString databasePath;
+    QSet<QString> configIds;
+    QSet<QString> liveAuthcfgs;
+    int maxAge;
+};
+
+// msecs before queued requests are checked again, while a caller thread links or refreshes their authcfg
+static const int PENDING_RETRY_INTERVAL = 200;
+
+// seconds after startup before stale token caches are collected, so it does not compete with loading projects
+static const int TOKEN_CACHE_GC_DELAY = 30;
+
+
+void QgsAuthOAuth2TokenSnapshot::setToken( const QString &accesstoken )
+{
+  token = accesstoken;
+  authorizationHeader = QByteArray( "Bearer " ) + accesstoken.toAscii();
+  queryItem = ACCESS_TOKEN_ITEM + '=' + QUrl::toPercentEncoding( accesstoken );
+}
+
+
+QgsAuthOAuth2PendingRequest::QgsAuthOAuth2PendingRequest( const QNetworkRequest &request, const QString &authcfg,
+    QObject *parent )
+  : QObject( parent )
+  , mRequest( request )
+  , mAuthcfg( authcfg )
+  , mFinished( false )
+  , mSucceeded( false )
+{
+}
+
+QNetworkRequest QgsAuthOAuth2PendingRequest::request() const
+{
+  QMutexLocker locker( &mMutex );
+  return mRequest;
+}
+
+bool QgsAuthOAuth2PendingRequest::isFinished() const
+{
+  QMutexLocker locker( &mMutex );
+  return mFinished;
+}
+
+bool QgsAuthOAuth2PendingRequest::succeeded() const
+{
+  QMutexLocker locker( &mMutex );
+  return mSucceeded;
+}
+
+void QgsAuthOAuth2PendingRequest::settle( const QNetworkRequest &request, bool ok )
+{
+  {
+    QMutexLocker locker( &mMutex );
+    mRequest = request;
+    mSucceeded = ok;
+    mFinished = true;
+  }
+  // always deliver in the requesting thread, even when settled right away
+  QMetaObject::invokeMethod( this, "emitFinished", Qt::QueuedConnection );
+}
+
+// slot
+void QgsAuthOAuth2PendingRequest::emitFinished()
+{
+  emit finished( succeeded() );
+}
 
 
 QgsAuthOAuth2Method::QgsAuthOAuth2Method()
   : QgsAuthMethod()
+  , mBundleCacheCapacity( 100 )
+  , mBundleIdleTimeout( 0 )
+  , mBundleCacheHits( 0 )
+  , mBundleCacheMisses( 0 )
+  , mBundleCacheEvictions( 0 )
+  , mBundleCacheFailedHits( 0 )
+  , mFailedBundleTtl( 30 )
+  , mBundleSweepTimer( nullptr )
+  , mMigrationRetryTimer( nullptr )
+  , mRefreshJitter( 30 )
+  , mTokenCacheWatcher( nullptr )
+  , mTokenCacheMaxAge( 86400 )
+  , mLogLevel( LogInfo )
+  , mLogSummaryTimer( nullptr )
 {
   setVersion( 1 );
   setExpansions( QgsAuthMethod::NetworkRequest | QgsAuthMethod::NetworkReply );
@@ -66,21 +234,82 @@ QgsAuthOAuth2Method::QgsAuthOAuth2Method()
       QgsDebugMsg( QStringLiteral( "FAILED to create cache dir: %1" ).arg( cachedirpath ) );
     }
   }
+
+  mTokenCacheWatcher = new QFileSystemWatcher( cachedirpaths, this );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( mTokenCacheWatcher, SIGNAL( directoryChanged( QString ) ),
+           this, SLOT( onTokenCacheDirectoryChanged( QString ) ) );
+#else
+  connect( mTokenCacheWatcher, &QFileSystemWatcher::directoryChanged,
+           this, &QgsAuthOAuth2Method::onTokenCacheDirectoryChanged );
+#endif
+
+  QSettings settings;
+  setLogLevel( static_cast<LogLevel>( settings.value( QStringLiteral( "oauth2/logLevel" ),
+                                      static_cast<int>( LogInfo ) ).toInt() ) );
+
+  mLogSummaryTimer = new QTimer( this );
+  mLogSummaryTimer->setInterval( LOG_SUMMARY_INTERVAL * 1000 );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( mLogSummaryTimer, SIGNAL( timeout() ), this, SLOT( logRequestSummaries() ) );
+#else
+  connect( mLogSummaryTimer, &QTimer::timeout, this, &QgsAuthOAuth2Method::logRequestSummaries );
+#endif
+  mLogSummaryTimer->start();
+
+  setBundleCacheCapacity( settings.value( QStringLiteral( "oauth2/bundleCacheCapacity" ), 100 ).toInt() );
+  setBundleIdleTimeout( settings.value( QStringLiteral( "oauth2/bundleIdleTimeout" ), 0 ).toInt() );
+  setFailedBundleTtl( settings.value( QStringLiteral( "oauth2/failedBundleTtl" ), 30 ).toInt() );
+
+  mBundleSweepTimer = new QTimer( this );
+  mBundleSweepTimer->setInterval( BUNDLE_SWEEP_INTERVAL * 1000 );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( mBundleSweepTimer, SIGNAL( timeout() ), this, SLOT( sweepOAuth2Bundles() ) );
+#else
+  connect( mBundleSweepTimer, &QTimer::timeout, this, &QgsAuthOAuth2Method::sweepOAuth2Bundles );
+#endif
+  mBundleSweepTimer->start();
+
+  mMigrationRetryTimer = new QTimer( this );
+  mMigrationRetryTimer->setSingleShot( true );
+  mMigrationRetryTimer->setInterval( PENDING_RETRY_INTERVAL );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( mMigrationRetryTimer, SIGNAL( timeout() ), this, SLOT( processDeferredTokenCacheMigrations() ) );
+#else
+  connect( mMigrationRetryTimer, &QTimer::timeout, this, &QgsAuthOAuth2Method::processDeferredTokenCacheMigrations );
+#endif
+
+  setTokenCacheMaxAge( settings.value( QStringLiteral( "oauth2/tokenCacheMaxAge" ), 86400 ).toInt() );
+  QTimer::singleShot( TOKEN_CACHE_GC_DELAY * 1000, this, SLOT( collectTokenCacheGarbage() ) );
 }
 
 QgsAuthOAuth2Method::~QgsAuthOAuth2Method()
 {
-  QDir tempdir( QgsAuthOAuth2Config::tokenCacheDirectory( true ) );
-  QStringList dirlist = tempdir.entryList( QDir::Files | QDir::NoDotAndDotDot );
-  Q_FOREACH ( const QString &f, dirlist )
   {
-    QString tempfile( tempdir.path() + QStringLiteral( "/" ) + f );
-    if ( !QFile::remove( tempfile ) )
+    QMutexLocker locker( &mBundlesMutex );
+    Q_FOREACH ( const QgsAuthOAuth2BundleEntry &entry, mBundles )
     {
-      QgsDebugMsg( QStringLiteral( "FAILED to delete temp token cache file: %1" ).arg( tempfile ) );
+      // bundles made by worker threads belong to those threads, so leave them to their own
+      // event loops, as eviction does, rather than delete them from under this one
+      if ( entry.bundle->thread() == QThread::currentThread() )
+      {
+        delete entry.bundle;
+      }
+      else
+      {
+        entry.bundle->deleteLater();
+      }
     }
+    mBundles.clear();
   }
-  if ( !tempdir.rmdir( tempdir.path() ) )
+
+  // deleting the bundles removed their temporary caches; those of other running sessions
+  // are theirs to remove, and those of crashed sessions are collected on a later startup
+  mTokenCacheGc.waitForFinished();
+
+  QDir tempdir( QgsAuthOAuth2Config::tokenCacheDirectory( true ) );
+  if ( tempdir.exists() && tempdir.entryList( QDir::Files | QDir::NoDotAndDotDot ).isEmpty()
+       && !tempdir.rmdir( tempdir.path() ) )
   {
     QgsDebugMsg( QStringLiteral( "FAILED to delete temp token cache directory: %1" ).arg( tempdir.path() ) );
   }
@@ -104,9 +333,60 @@ QString QgsAuthOAuth2Method::displayDescription() const
 bool QgsAuthOAuth2Method::updateNetworkRequest( QNetworkRequest &request, const QString &authcfg,
     const QString &dataprovider )
 {
-  Q_UNUSED( dataprovider )
+  // Fast path: a linked token that is not about to expire has already been published for
+  // this authcfg, so decorate from that copy without queuing behind other requests.
+  // No file system access here: external removal of the token cache clears the snapshot.
+  QgsAuthOAuth2TokenSnapshot snapshot = tokenSnapshot( authcfg );
+  if ( !snapshot.isNull() && !tokenExpiring( snapshot.expires ) )
+  {
+    return decorateRequest( request, authcfg, snapshot );
+  }
+
+  // Other threads link and refresh in their own event loop, as the authenticators always have:
+  // queuing onto this object's thread would hang a worker whose work that thread is blocked
+  // waiting on, e.g. the GUI thread waiting on render jobs.
+  if ( QThread::currentThread() != thread() )
+  {
+    return updateNetworkRequestInThread( request, authcfg );
+  }
 
-  QMutexLocker locker( &mNetworkRequestMutex );
+  // compatibility wrapper: wait in a local event loop for the queued request to be released
+  QScopedPointer<QgsAuthOAuth2PendingRequest> pending( updateNetworkRequestAsync( request, authcfg, dataprovider ) );
+  if ( !waitForPendingRequest( pending.data(), pendingTimeout( authcfg ) ) )
+  {
+    return false;
+  }
+  request = pending->request();
+  return true;
+}
+
+bool QgsAuthOAuth2Method::updateNetworkRequestInThread( QNetworkRequest &request, const QString &authcfg )
+{
+  // only requests for this authcfg wait on a slow link or refresh of its identity provider;
+  // held until that is done, so other threads wait for its token rather than start their own
+  QSharedPointer<QMutex> authcfgmutex = authcfgMutex( authcfg );
+  QMutexLocker locker( authcfgmutex.data() );
+
+  // a request that held the lock before us may have just linked or refreshed this authcfg
+  QgsAuthOAuth2TokenSnapshot snapshot = tokenSnapshot( authcfg );
+  if ( !snapshot.isNull() && !tokenExpiring( snapshot.expires ) )
+  {
+    return decorateRequest( request, authcfg, snapshot );
+  }
+
+  if ( hasPendingRequests( authcfg ) )
+  {
+    // a link or refresh started for queued requests is underway; join it, timing out
+    // in this thread's own event loop, should this object's thread be blocked
+    locker.unlock();
+    QScopedPointer<QgsAuthOAuth2PendingRequest> pending( updateNetworkRequestAsync( request, authcfg ) );
+    if ( !waitForPendingRequest( pending.data(), pendingTimeout( authcfg ) ) )
+    {
+      return false;
+    }
+    request = pending->request();
+    return true;
+  }
 
   QString msg;
 
@@ -121,84 +401,63 @@ bool QgsAuthOAuth2Method::updateNetworkRequest( QNetworkRequest &request, const
   if ( o2->linked() )
   {
     // Check if the cache file has been deleted outside core method routines
-    QString tokencache = QgsAuthOAuth2Config::tokenCachePath( authcfg, !o2->oauth2config()->persistToken() );
-    if ( !QFile::exists( tokencache ) )
+    // (only done off the fast path, i.e. before a snapshot is first published and on refresh)
+    // a freshly linked token may still be being written behind
+    if ( !QFile::exists( o2->tokenCacheFile() )
+         && !( o2->tokenStore() && o2->tokenStore()->hasPendingWrites() ) )
     {
       msg = QStringLiteral( "Token cache removed for authcfg %1: unlinking authenticator" ).arg( authcfg );
       QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+      clearTokenSnapshot( authcfg );
       o2->unlink();
     }
   }
 
-  if ( o2->linked() )
+  // keep the local event loops from blocking forever, should a refresh or link never report back
+  int reqtimeout = o2->oauth2config()->requestTimeout() * 1000;
+
+  if ( o2->linked() && tokenExpiring( o2->expires() ) )
   {
-    // First, check if it is expired
-    bool expired = false;
-    if ( o2->expires() > 0 )  // QStringLiteral("").toInt() result for tokens with no expiration
-    {
-      int cursecs = static_cast<int>( QDateTime::currentDateTime().toMSecsSinceEpoch() / 1000 );
-      expired = ( ( o2->expires() - cursecs ) < 120 ); // try refresh with expired or two minutes to go
-    }
+    msg = QStringLiteral( "Token expired, attempting refresh for authcfg %1" ).arg( authcfg );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
 
-    if ( expired )
-    {
-      msg = QStringLiteral( "Token expired, attempting refresh for authcfg %1" ).arg( authcfg );
-      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+    clearTokenSnapshot( authcfg );
 
-      // Try to get a refresh token first
-      // go into local event loop and wait for a fired refresh-related slot
-      QEventLoop rloop( nullptr );
+    // go into local event loop and wait for a fired refresh-related slot
+    QEventLoop rloop( nullptr );
 #if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
-      rloop.connect( o2, SIGNAL( refreshFinished( QNetworkReply::NetworkError ) ), SLOT( quit() ) );
+    rloop.connect( o2, SIGNAL( refreshFinished( QNetworkReply::NetworkError ) ), SLOT( quit() ) );
 #else
-      connect( o2, &QgsO2::refreshFinished, &rloop, &QEventLoop::quit );
+    connect( o2, &QgsO2::refreshFinished, &rloop, &QEventLoop::quit );
 #endif
 
-      // Asynchronously attempt the refresh
-      // TODO: This already has a timed reply setup in O2 base class (and in QgsNetworkAccessManager!)
-      //       May need to address this or app crashes will occur!
-      o2->refresh();
+    QTimer rtimer( nullptr );
+    rtimer.setInterval( reqtimeout * 5 );
+    rtimer.setSingleShot( true );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+    rloop.connect( &rtimer, SIGNAL( timeout() ), SLOT( quit() ) );
+#else
+    connect( &rtimer, &QTimer::timeout, &rloop, &QEventLoop::quit );
+#endif
 
-      // block request update until asynchronous linking loop is quit
+    // Asynchronously attempt the refresh, or join one already started for a 401 reply
+    if ( o2->requestRefresh() )
+    {
+      // block request update until asynchronous refresh loop is quit
+      rtimer.start();
       rloop.exec();
-
-      // refresh result should set o2 to (un)linked
+      rtimer.stop();
     }
+
+    // refresh result should set o2 to (un)linked
   }
 
   if ( !o2->linked() )
   {
     // link app
     // clear any previous token session properties
+    clearTokenSnapshot( authcfg );
     o2->unlink();
-#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
-    connect( o2, SIGNAL( linkedChanged() ), this, SLOT( onLinkedChanged() ), Qt::UniqueConnection );
-    connect( o2, SIGNAL( linkingFailed() ), this, SLOT( onLinkingFailed() ), Qt::UniqueConnection );
-    connect( o2, SIGNAL( linkingSucceeded() ), this, SLOT( onLinkingSucceeded() ), Qt::UniqueConnection );
-    connect( o2, SIGNAL( openBrowser( QUrl ) ), this, SLOT( onOpenBrowser( QUrl ) ), Qt::UniqueConnection );
-    connect( o2, SIGNAL( closeBrowser() ), this, SLOT( onCloseBrowser() ), Qt::UniqueConnection );
-#else
-    connect( o2, &QgsO2::linkedChanged, this, &QgsAuthOAuth2Method::onLinkedChanged, Qt::UniqueConnection );
-    connect( o2, &QgsO2::linkingFailed, this, &QgsAuthOAuth2Method::onLinkingFailed, Qt::UniqueConnection );
-    connect( o2, &QgsO2::linkingSucceeded, this, &QgsAuthOAuth2Method::onLinkingSucceeded, Qt::UniqueConnection );
-    connect( o2, &QgsO2::openBrowser, this, &QgsAuthOAuth2Method::onOpenBrowser, Qt::UniqueConnection );
-    connect( o2, &QgsO2::closeBrowser, this, &QgsAuthOAuth2Method::onCloseBrowser, Qt::UniqueConnection );
-#endif
-
-    //qRegisterMetaType<QNetworkReply::NetworkError>( QStringLiteral( "QNetworkReply::NetworkError" )) // for Qt::QueuedConnection, if needed;
-#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
-    connect( o2, SIGNAL( refreshFinished( QNetworkReply::NetworkError ) ),
-             this, SLOT( onRefreshFinished( QNetworkReply::NetworkError ) ), Qt::UniqueConnection );
-#else
-    connect( o2, &QgsO2::refreshFinished, this, &QgsAuthOAuth2Method::onRefreshFinished, Qt::UniqueConnection );
-#endif
-
-
-    QSettings settings;
-    QString timeoutkey = QStringLiteral( "/qgis/networkAndProxy/networkTimeout" );
-    int prevtimeout = settings.value( timeoutkey, QStringLiteral( "-1" ) ).toInt();
-    int reqtimeout = o2->oauth2config()->requestTimeout() * 1000;
-    settings.setValue( timeoutkey, reqtimeout );
 
     // go into local event loop and wait for a fired linking-related slot
     QEventLoop loop( nullptr );
@@ -210,15 +469,14 @@ bool QgsAuthOAuth2Method::updateNetworkRequest( QNetworkRequest &request, const
     connect( o2, &QgsO2::linkingSucceeded, &loop, &QEventLoop::quit );
 #endif
 
-    // add singlshot timer to quit linking after an alloted timeout
-    // this should keep the local event loop from blocking forever
+    // token endpoint calls are timed out by the authenticator; this bounds the whole link
     QTimer timer( nullptr );
     timer.setInterval( reqtimeout * 5 );
     timer.setSingleShot( true );
 #if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
-    connect( &timer, SIGNAL( timeout() ), o2, SIGNAL( linkingFailed() ) );
+    loop.connect( &timer, SIGNAL( timeout() ), SLOT( quit() ) );
 #else
-    connect( &timer, &QTimer::timeout, o2, &QgsO2::linkingFailed );
+    connect( &timer, &QTimer::timeout, &loop, &QEventLoop::quit );
 #endif
     timer.start();
 
@@ -227,20 +485,7 @@ bool QgsAuthOAuth2Method::updateNetworkRequest( QNetworkRequest &request, const
 
     // block request update until asynchronous linking loop is quit
     loop.exec();
-    if ( timer.isActive() )
-    {
-      timer.stop();
-    }
-
-    // don't re-apply a setting that wasn't already set
-    if ( prevtimeout == -1 )
-    {
-      settings.remove( timeoutkey );
-    }
-    else
-    {
-      settings.setValue( timeoutkey, prevtimeout );
-    }
+    timer.stop();
 
     if ( !o2->linked() )
     {
@@ -257,129 +502,471 @@ bool QgsAuthOAuth2Method::updateNetworkRequest( QNetworkRequest &request, const
     return false;
   }
 
-  // update the request
-  QgsAuthOAuth2Config::AccessMethod accessmethod = o2->oauth2config()->accessMethod();
+  // later requests for this authcfg can now take the fast path
+  snapshot = publishTokenSnapshot( authcfg, o2 );
+
+  return decorateRequest( request, authcfg, snapshot );
+}
 
-  QUrl url = request.url();
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-  QUrlQuery query( url );
+bool QgsAuthOAuth2Method::waitForPendingRequest( QgsAuthOAuth2PendingRequest *pending, int msecs )
+{
+  QEventLoop loop( nullptr );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  loop.connect( pending, SIGNAL( finished( bool ) ), SLOT( quit() ) );
+#else
+  connect( pending, &QgsAuthOAuth2PendingRequest::finished, &loop, &QEventLoop::quit );
 #endif
-  switch ( accessmethod )
-  {
-    case QgsAuthOAuth2Config::Header:
-      request.setRawHeader( O2_HTTP_AUTHORIZATION_HEADER, QStringLiteral( "Bearer %1" ).arg( o2->token() ).toAscii() );
-      msg = QStringLiteral( "Updated request HEADER with access token for authcfg: %1" ).arg( authcfg );
-      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
-      break;
-    case QgsAuthOAuth2Config::Form:
-      // FIXME: what to do here if the parent request is not POST?
-      //        probably have to skip this until auth system support is moved into QgsNetworkAccessManager
-      msg = QStringLiteral( "Update request FAILED for authcfg %1: form POST token update is unsupported" ).arg( authcfg );
-      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
-      break;
-    case QgsAuthOAuth2Config::Query:
+
+  // armed in the waiting thread, so the wait ends even if the thread releasing requests is blocked
+  QTimer timer( nullptr );
+  timer.setInterval( msecs );
+  timer.setSingleShot( true );
 #if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
-      if ( !url.hasQueryItem( O2_OAUTH2_ACCESS_TOKEN ) )
-      {
-        url.addQueryItem( O2_OAUTH2_ACCESS_TOKEN, o2->token() );
+  loop.connect( &timer, SIGNAL( timeout() ), SLOT( quit() ) );
 #else
-      if ( !query.hasQueryItem( O2_OAUTH2_ACCESS_TOKEN ) )
-      {
-        query.addQueryItem( O2_OAUTH2_ACCESS_TOKEN, o2->token() );
-        url.setQuery( query );
+  connect( &timer, &QTimer::timeout, &loop, &QEventLoop::quit );
 #endif
-        request.setUrl( url );
-        msg = QStringLiteral( "Updated request QUERY with access token for authcfg: %1" ).arg( authcfg );
-      }
-      else
-      {
-        msg = QStringLiteral( "Updated request QUERY with access token SKIPPED (existing token) for authcfg: %1" ).arg( authcfg );
-      }
-      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
-      break;
+
+  // finished() is always queued to this thread, so it can not be missed between check and exec
+  if ( !pending->isFinished() )
+  {
+    timer.start();
+    loop.exec();
+    timer.stop();
   }
 
-  return true;
+  if ( !pending->isFinished() )
+  {
+    QString msg = QStringLiteral( "Update request timed out for authcfg %1" ).arg( pending->authcfg() );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    return false;
+  }
+  return pending->succeeded();
 }
 
-bool QgsAuthOAuth2Method::updateNetworkReply( QNetworkReply *reply, const QString &authcfg, const QString &dataprovider )
+int QgsAuthOAuth2Method::pendingTimeout( const QString &authcfg )
+{
+  // the bundle is not loaded yet for requests queued before the first link
+  QgsO2 *o2 = cachedOAuth2Bundle( authcfg );
+  int reqtimeout = ( o2 ? o2->oauth2config()->requestTimeout() : QgsAuthOAuth2ConfigData().requestTimeout() ) * 1000;
+  return reqtimeout * 5;
+}
+
+QgsAuthOAuth2PendingRequest *QgsAuthOAuth2Method::updateNetworkRequestAsync( const QNetworkRequest &request,
+    const QString &authcfg, const QString &dataprovider )
 {
   Q_UNUSED( dataprovider )
-  QMutexLocker locker( &mNetworkRequestMutex );
 
-  // TODO: handle token refresh error on the reply, see O2Requestor::onRequestError()
-  // Is this doable if the errors are also handled in qgsapp (and/or elsewhere)?
-  // Can we block as long as needed if the reply gets deleted elsewhere,
-  // or will a local loop's connection keep it alive after a call to deletelater()?
+  QgsAuthOAuth2PendingRequest *pending = new QgsAuthOAuth2PendingRequest( request, authcfg );
 
-  if ( !reply )
+  QgsAuthOAuth2TokenSnapshot snapshot = tokenSnapshot( authcfg );
+  if ( !snapshot.isNull() && !tokenExpiring( snapshot.expires ) )
   {
-    QString msg = QStringLiteral( "Updated reply with token refresh connection FAILED"
-                                  " for authcfg %1: null reply object" ).arg( authcfg );
-    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
-    return false;
+    QNetworkRequest decorated( request );
+    bool ok = decorateRequest( decorated, authcfg, snapshot );
+    pending->settle( decorated, ok );
+    return pending;
   }
-  reply->setProperty( "authcfg", authcfg );
-
-  // converting this to new-style Qt5 connection causes odd linking error with static o2 library
-  connect( reply, SIGNAL( error( QNetworkReply::NetworkError ) ),
-           this, SLOT( onNetworkError( QNetworkReply::NetworkError ) ), Qt::QueuedConnection );
-  //connect( reply, static_cast<void ( QNetworkReply::* )( QNetworkReply::NetworkError )>( &QNetworkReply::error ),
-  //         this, &QgsAuthOAuth2Method::onNetworkError, Qt::QueuedConnection );
-
-  QString msg = QStringLiteral( "Updated reply with token refresh connection for authcfg: %1" ).arg( authcfg );
-  QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
 
-  return true;
+  // Queue behind any link or refresh already underway for this authcfg; the first
+  // request queued starts one, in this object's thread, where the authenticators live.
+  bool start = false;
+  {
+    QMutexLocker locker( &mPendingRequestsMutex );
+    QList< QPointer<QgsAuthOAuth2PendingRequest> > &queue = mPendingRequests[ authcfg ];
+    start = queue.isEmpty();
+    queue << QPointer<QgsAuthOAuth2PendingRequest>( pending );
+  }
+  if ( start )
+  {
+    QMetaObject::invokeMethod( this, "processPendingRequests", Qt::QueuedConnection,
+                               Q_ARG( QString, authcfg ) );
+  }
+  return pending;
 }
 
-void QgsAuthOAuth2Method::onLinkedChanged()
+// slot
+void QgsAuthOAuth2Method::processPendingRequests( const QString &authcfg )
 {
-  // Linking (login) state has changed.
-  // Use o2->linked() to get the actual state
-  QgsDebugMsg( QStringLiteral( "Link state changed" ) );
-}
+  // held only while checking state and starting a link or refresh, never while waiting on one;
+  // a caller thread linking or refreshing this authcfg itself holds it throughout, so check
+  // again shortly, rather than block this thread until it is done
+  QSharedPointer<QMutex> authcfgmutex = authcfgMutex( authcfg );
+  if ( !authcfgmutex->tryLock() )
+  {
+    mDeferredPendingRequests.insert( authcfg );
+    QTimer::singleShot( PENDING_RETRY_INTERVAL, this, SLOT( processDeferredPendingRequests() ) );
+    return;
+  }
+  bool release = startPendingRequests( authcfg );
+  authcfgmutex->unlock();
 
-void QgsAuthOAuth2Method::onLinkingFailed()
-{
-  // Login has failed
-  QgsMessageLog::logMessage( tr( "Authenticator linking (login) has failed" ), AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+  if ( release )
+  {
+    releasePendingRequests( authcfg );
+  }
 }
 
-void QgsAuthOAuth2Method::onLinkingSucceeded()
+// slot
+void QgsAuthOAuth2Method::processDeferredPendingRequests()
 {
-  QgsO2 *o2 = qobject_cast<QgsO2 *>( sender() );
-  if ( !o2 )
+  QSet<QString> deferred;
+  deferred.swap( mDeferredPendingRequests );
+  Q_FOREACH ( const QString &authcfg, deferred )
   {
-    QgsMessageLog::logMessage( tr( "Linking succeeded, but authenticator access FAILED: null object" ),
-                               AUTH_METHOD_KEY, QgsMessageLog::WARNING );
-    return;
+    processPendingRequests( authcfg );
   }
+}
 
-  if ( !o2->linked() )
+bool QgsAuthOAuth2Method::startPendingRequests( const QString &authcfg )
+{
+  // a refresh finished since the requests were queued, e.g. a background one
+  QgsAuthOAuth2TokenSnapshot snapshot = tokenSnapshot( authcfg );
+  if ( !snapshot.isNull() && !tokenExpiring( snapshot.expires ) )
   {
-    QgsMessageLog::logMessage( tr( "Linking apparently succeeded, but authenticator FAILED to verify it is linked" ),
-                               AUTH_METHOD_KEY, QgsMessageLog::WARNING );
-    return;
+    return true;
   }
 
-  QgsMessageLog::logMessage( tr( "Linking succeeded" ), AUTH_METHOD_KEY, QgsMessageLog::INFO );
+  QString msg;
 
-  //###################### DO NOT LEAVE ME UNCOMMENTED ######################
-  //QgsDebugMsg( QStringLiteral( "Access token: %1" ).arg( o2->token() ) );
-  //QgsDebugMsg( QStringLiteral( "Access token secret: %1" ).arg( o2->tokenSecret() ) );
-  //###################### DO NOT LEAVE ME UNCOMMENTED ######################
+  QgsO2 *o2 = getOAuth2Bundle( authcfg );
+  if ( !o2 )
+  {
+    msg = QStringLiteral( "Update request FAILED for authcfg %1: null object for requestor" ).arg( authcfg );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    return true;
+  }
 
-  QVariantMap extraTokens = o2->extraTokens();
-  if ( !extraTokens.isEmpty() )
+  if ( o2->linked() )
   {
-    QString msg = QStringLiteral( "Extra tokens in response:\n" );
-    Q_FOREACH ( const QString &key, extraTokens.keys() )
+    // Check if the cache file has been deleted outside core method routines
+    // (only done off the fast path, i.e. before a snapshot is first published and on refresh)
+    // a freshly linked token may still be being written behind
+    if ( !QFile::exists( o2->tokenCacheFile() )
+         && !( o2->tokenStore() && o2->tokenStore()->hasPendingWrites() ) )
     {
-      // don't expose the values in a log (unless they are only 3 chars long, of course)
-      msg += QStringLiteral( "    %1:%2...\n" ).arg( key, extraTokens.value( key ).toString().left( 3 ) );
+      msg = QStringLiteral( "Token cache removed for authcfg %1: unlinking authenticator" ).arg( authcfg );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+      clearTokenSnapshot( authcfg );
+      o2->unlink();
     }
-    QgsDebugMsg( msg );
+  }
+
+  // keep queued requests from waiting forever, should a refresh or link never report back
+  int reqtimeout = o2->oauth2config()->requestTimeout() * 1000;
+
+  if ( o2->linked() && tokenExpiring( o2->expires() ) )
+  {
+    msg = QStringLiteral( "Token expired, attempting refresh for authcfg %1" ).arg( authcfg );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+
+    clearTokenSnapshot( authcfg );
+
+    // Asynchronously attempt the refresh, or join one already started for a 401 reply;
+    // onRefreshFinished() releases the queued requests, or links on failure
+    startPendingTimeout( authcfg, reqtimeout * 5 );
+    if ( o2->requestRefresh() )
+    {
+      mPendingRefreshes.insert( authcfg );
+      return false;
+    }
+    // refresh failed right away (e.g. no refresh token) and o2 is now unlinked
+    stopPendingTimeout( authcfg );
+  }
+
+  if ( !o2->linked() )
+  {
+    // link app
+    // clear any previous token session properties
+    clearTokenSnapshot( authcfg );
+    o2->unlink();
+
+    // asynchronously attempt the linking; onLinkingSucceeded() or onLinkingFailed()
+    // release the queued requests (token endpoint calls are timed out by the authenticator)
+    startPendingTimeout( authcfg, reqtimeout * 5 );
+    o2->link();
+    return false;
+  }
+
+  return true;
+}
+
+void QgsAuthOAuth2Method::releasePendingRequests( const QString &authcfg )
+{
+  stopPendingTimeout( authcfg );
+  mPendingRefreshes.remove( authcfg );
+
+  QString msg;
+  QgsAuthOAuth2TokenSnapshot snapshot = tokenSnapshot( authcfg );
+  if ( snapshot.isNull() || tokenExpiring( snapshot.expires ) )
+  {
+    snapshot = QgsAuthOAuth2TokenSnapshot();
+
+    QgsO2 *o2 = cachedOAuth2Bundle( authcfg );
+    if ( !o2 )
+    {
+      // failure already logged, or bundle cleared while linking
+    }
+    else if ( !o2->linked() )
+    {
+      msg = QStringLiteral( "Update request FAILED for authcfg %1: requestor could not link app" ).arg( authcfg );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    }
+    else if ( o2->token().isEmpty() )
+    {
+      msg = QStringLiteral( "Update request FAILED for authcfg %1: access token is empty" ).arg( authcfg );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    }
+    else
+    {
+      // later requests for this authcfg can now take the fast path
+      snapshot = publishTokenSnapshot( authcfg, o2 );
+    }
+  }
+
+  QList< QPointer<QgsAuthOAuth2PendingRequest> > queue;
+  {
+    QMutexLocker locker( &mPendingRequestsMutex );
+    queue = mPendingRequests.take( authcfg );
+  }
+
+  Q_FOREACH ( const QPointer<QgsAuthOAuth2PendingRequest> &pending, queue )
+  {
+    if ( pending.isNull() )
+    {
+      continue;
+    }
+    QNetworkRequest request = pending->request();
+    bool ok = !snapshot.isNull() && decorateRequest( request, authcfg, snapshot );
+    pending->settle( request, ok );
+  }
+}
+
+bool QgsAuthOAuth2Method::hasPendingRequests( const QString &authcfg )
+{
+  QMutexLocker locker( &mPendingRequestsMutex );
+  return mPendingRequests.contains( authcfg );
+}
+
+void QgsAuthOAuth2Method::startPendingTimeout( const QString &authcfg, int msecs )
+{
+  QTimer *timer = mPendingTimeouts.value( authcfg, nullptr );
+  if ( !timer )
+  {
+    timer = new QTimer( this );
+    timer->setSingleShot( true );
+    timer->setProperty( "authcfg", authcfg );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+    connect( timer, SIGNAL( timeout() ), this, SLOT( onPendingRequestsTimeout() ) );
+#else
+    connect( timer, &QTimer::timeout, this, &QgsAuthOAuth2Method::onPendingRequestsTimeout );
+#endif
+    mPendingTimeouts.insert( authcfg, timer );
+  }
+  timer->start( msecs );
+}
+
+void QgsAuthOAuth2Method::stopPendingTimeout( const QString &authcfg )
+{
+  QTimer *timer = mPendingTimeouts.take( authcfg );
+  if ( timer )
+  {
+    timer->stop();
+    timer->deleteLater();
+  }
+}
+
+// slot
+void QgsAuthOAuth2Method::onPendingRequestsTimeout()
+{
+  QTimer *timer = qobject_cast<QTimer *>( sender() );
+  if ( !timer )
+  {
+    return;
+  }
+  QString authcfg = timer->property( "authcfg" ).toString();
+
+  QString msg = QStringLiteral( "Update request timed out for authcfg %1: releasing queued requests" ).arg( authcfg );
+  QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+  releasePendingRequests( authcfg );
+}
+
+QString QgsAuthOAuth2Method::requestToken( const QNetworkRequest &request )
+{
+  QByteArray header = request.rawHeader( O2_HTTP_AUTHORIZATION_HEADER );
+  if ( header.startsWith( "Bearer " ) )
+  {
+    return QString::fromLatin1( header.mid( 7 ) );
+  }
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  return request.url().queryItemValue( O2_OAUTH2_ACCESS_TOKEN );
+#else
+  return QUrlQuery( request.url() ).queryItemValue( O2_OAUTH2_ACCESS_TOKEN );
+#endif
+}
+
+bool QgsAuthOAuth2Method::decorateRequest( QNetworkRequest &request, const QString &authcfg,
+    const QgsAuthOAuth2TokenSnapshot &snapshot )
+{
+  QString msg;
+
+  // update the request
+  QgsAuthOAuth2Config::AccessMethod accessmethod = snapshot.accessMethod;
+
+  switch ( accessmethod )
+  {
+    case QgsAuthOAuth2Config::Header:
+      // shares the bytes encoded when the token was published
+      request.setRawHeader( AUTHORIZATION_HEADER, snapshot.authorizationHeader );
+      if ( logEnabled( LogVerbose ) )
+      {
+        msg = QStringLiteral( "Updated request HEADER with access token for authcfg: %1" ).arg( authcfg );
+        QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+      }
+      break;
+    case QgsAuthOAuth2Config::Form:
+      // FIXME: what to do here if the parent request is not POST?
+      //        probably have to skip this until auth system support is moved into QgsNetworkAccessManager
+      msg = QStringLiteral( "Update request FAILED for authcfg %1: form POST token update is unsupported" ).arg( authcfg );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+      break;
+    case QgsAuthOAuth2Config::Query:
+    {
+      QUrl url = request.url();
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+      QByteArray query = url.encodedQuery();
+#else
+      QByteArray query = url.query( QUrl::FullyEncoded ).toLatin1();
+#endif
+      if ( !hasAccessTokenItem( query ) )
+      {
+        // append the item percent encoded when the token was published
+        if ( !query.isEmpty() )
+        {
+          query += '&';
+        }
+        query += snapshot.queryItem;
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+        url.setEncodedQuery( query );
+#else
+        url.setQuery( QString::fromLatin1( query ) );
+#endif
+        request.setUrl( url );
+        if ( logEnabled( LogVerbose ) )
+        {
+          msg = QStringLiteral( "Updated request QUERY with access token for authcfg: %1" ).arg( authcfg );
+        }
+      }
+      else if ( logEnabled( LogVerbose ) )
+      {
+        msg = QStringLiteral( "Updated request QUERY with access token SKIPPED (existing token) for authcfg: %1" ).arg( authcfg );
+      }
+      if ( !msg.isEmpty() )
+      {
+        QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+      }
+      break;
+    }
+  }
+
+  // counted for the periodic summary, in place of a message per request
+  if ( snapshot.decorations )
+  {
+    snapshot.decorations->ref();
+  }
+
+  return true;
+}
+
+bool QgsAuthOAuth2Method::updateNetworkReply( QNetworkReply *reply, const QString &authcfg, const QString &dataprovider )
+{
+  Q_UNUSED( dataprovider )
+
+  // TODO: handle token refresh error on the reply, see O2Requestor::onRequestError()
+  // Is this doable if the errors are also handled in qgsapp (and/or elsewhere)?
+  // Can we block as long as needed if the reply gets deleted elsewhere,
+  // or will a local loop's connection keep it alive after a call to deletelater()?
+
+  if ( !reply )
+  {
+    QString msg = QStringLiteral( "Updated reply with token refresh connection FAILED"
+                                  " for authcfg %1: null reply object" ).arg( authcfg );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    return false;
+  }
+  reply->setProperty( "authcfg", authcfg );
+
+  // converting this to new-style Qt5 connection causes odd linking error with static o2 library
+  connect( reply, SIGNAL( error( QNetworkReply::NetworkError ) ),
+           this, SLOT( onNetworkError( QNetworkReply::NetworkError ) ), Qt::QueuedConnection );
+  //connect( reply, static_cast<void ( QNetworkReply::* )( QNetworkReply::NetworkError )>( &QNetworkReply::error ),
+  //         this, &QgsAuthOAuth2Method::onNetworkError, Qt::QueuedConnection );
+
+  if ( logEnabled( LogVerbose ) )
+  {
+    QString msg = QStringLiteral( "Updated reply with token refresh connection for authcfg: %1" ).arg( authcfg );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+  }
+
+  return true;
+}
+
+void QgsAuthOAuth2Method::onLinkedChanged()
+{
+  // Linking (login) state has changed.
+  // Use o2->linked() to get the actual state
+  QgsDebugMsg( QStringLiteral( "Link state changed" ) );
+}
+
+void QgsAuthOAuth2Method::onLinkingFailed()
+{
+  // Login has failed
+  QgsMessageLog::logMessage( tr( "Authenticator linking (login) has failed" ), AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+
+  QgsO2 *o2 = qobject_cast<QgsO2 *>( sender() );
+  if ( o2 )
+  {
+    releasePendingRequests( o2->authcfg() );
+  }
+}
+
+void QgsAuthOAuth2Method::onLinkingSucceeded()
+{
+  QgsO2 *o2 = qobject_cast<QgsO2 *>( sender() );
+  if ( !o2 )
+  {
+    QgsMessageLog::logMessage( tr( "Linking succeeded, but authenticator access FAILED: null object" ),
+                               AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    return;
+  }
+
+  if ( !o2->linked() )
+  {
+    QgsMessageLog::logMessage( tr( "Linking apparently succeeded, but authenticator FAILED to verify it is linked" ),
+                               AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    releasePendingRequests( o2->authcfg() );
+    return;
+  }
+
+  QgsMessageLog::logMessage( tr( "Linking succeeded" ), AUTH_METHOD_KEY, QgsMessageLog::INFO );
+
+  releasePendingRequests( o2->authcfg() );
+
+  //###################### DO NOT LEAVE ME UNCOMMENTED ######################
+  //QgsDebugMsg( QStringLiteral( "Access token: %1" ).arg( o2->token() ) );
+  //QgsDebugMsg( QStringLiteral( "Access token secret: %1" ).arg( o2->tokenSecret() ) );
+  //###################### DO NOT LEAVE ME UNCOMMENTED ######################
+
+  QVariantMap extraTokens = o2->extraTokens();
+  if ( !extraTokens.isEmpty() )
+  {
+    QString msg = QStringLiteral( "Extra tokens in response:\n" );
+    Q_FOREACH ( const QString &key, extraTokens.keys() )
+    {
+      // don't expose the values in a log (unless they are only 3 chars long, of course)
+      msg += QStringLiteral( "    %1:%2...\n" ).arg( key, extraTokens.value( key ).toString().left( 3 ) );
+    }
+    QgsDebugMsg( msg );
   }
 }
 
@@ -423,96 +1010,577 @@ void QgsAuthOAuth2Method::onReplyFinished()
                              AUTH_METHOD_KEY, QgsMessageLog::INFO );
 }
 
-void QgsAuthOAuth2Method::onNetworkError( QNetworkReply::NetworkError err )
+void QgsAuthOAuth2Method::onNetworkError( QNetworkReply::NetworkError err )
+{
+  QString msg;
+  QNetworkReply *reply = qobject_cast<QNetworkReply *>( sender() );
+  if ( !reply )
+  {
+    msg = tr( "Network error but no reply object accessible" );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    return;
+  }
+  if ( err != QNetworkReply::NoError )
+  {
+    msg = tr( "Network error: %1" ).arg( reply->errorString() );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+  }
+
+  // TODO: update debug messages to output to QGIS
+
+  int status = reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+  if ( logEnabled( LogVerbose ) )
+  {
+    msg = tr( "Network error, HTTP status: %1" ).arg(
+            reply->attribute( QNetworkRequest::HttpReasonPhraseAttribute ).toString() );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+  }
+
+  if ( status == 401 )
+  {
+    msg = tr( "Attempting token refresh..." );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+
+    QString authcfg = reply->property( "authcfg" ).toString();
+    if ( authcfg.isEmpty() )
+    {
+      msg = tr( "Token refresh FAILED: authcfg empty" );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+      return;
+    }
+
+    // get the cached authenticator
+    // don't build one here: that would contend with (and may block on) a request
+    // currently linking this authcfg, and a bundle that is gone has nothing to refresh
+    QgsO2 *o2 = cachedOAuth2Bundle( authcfg );
+    QString senttoken = requestToken( reply->request() );
+
+    if ( o2 && !senttoken.isEmpty() && o2->linked() && senttoken != o2->token() )
+    {
+      // the reply was sent with a token that has since been replaced by a finished refresh
+      msg = tr( "Background token refresh SKIPPED (token already refreshed) for authcfg: %1" ).arg( authcfg );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+    }
+    else if ( o2 )
+    {
+      // stop decorating further requests with the rejected token
+      clearTokenSnapshot( authcfg );
+
+      // Call O2::refresh, unless a burst of 401 replies already started one.
+      // Note the O2 instance might live in a different thread from reply,
+      // so don't block here. User will just have to re-attempt connection
+      o2->requestRefresh();
+
+      msg = tr( "Background token refresh underway for authcfg: %1" ).arg( authcfg );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+    }
+    else
+    {
+      msg = tr( "Background token refresh FAILED for authcfg %1: could not get authenticator object" ).arg( authcfg );
+      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    }
+  }
+}
+
+void QgsAuthOAuth2Method::onRefreshFinished( QNetworkReply::NetworkError err )
+{
+  QgsO2 *o2 = qobject_cast<QgsO2 *>( sender() );
+  if ( o2 )
+  {
+    QString authcfg = o2->authcfg();
+    if ( err == QNetworkReply::NoError && o2->linked() && !o2->token().isEmpty() )
+    {
+      // keep requests on the fast path across a (background) refresh; also re-arms its timer
+      publishTokenSnapshot( authcfg, o2 );
+      if ( hasPendingRequests( authcfg ) )
+      {
+        releasePendingRequests( authcfg );
+      }
+    }
+    else
+    {
+      // token was unlinked, so the next request has to link again
+      clearTokenSnapshot( authcfg );
+      cancelTokenRefresh( authcfg );
+      if ( mPendingRefreshes.remove( authcfg ) )
+      {
+        // requests queued on this refresh fall back to linking
+        stopPendingTimeout( authcfg );
+        QMetaObject::invokeMethod( this, "processPendingRequests", Qt::QueuedConnection,
+                                   Q_ARG( QString, authcfg ) );
+      }
+    }
+  }
+  if ( err != QNetworkReply::NoError )
+  {
+    QgsMessageLog::logMessage( tr( "Token refresh error: %1" ).arg( err ),
+                               AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+  }
+}
+
+bool QgsAuthOAuth2Method::updateDataSourceUriItems( QStringList &connectionItems, const QString &authcfg,
+    const QString &dataprovider )
+{
+  Q_UNUSED( connectionItems )
+  Q_UNUSED( authcfg )
+  Q_UNUSED( dataprovider )
+
+  return true;
+}
+
+void QgsAuthOAuth2Method::updateMethodConfig( QgsAuthMethodConfig &mconfig )
+{
+  if ( mconfig.hasConfig( QStringLiteral( "oldconfigstyle" ) ) )
+  {
+    QgsDebugMsg( QStringLiteral( "Updating old style auth method config" ) );
+  }
+
+  // NOTE: add updates as method version() increases due to config storage changes
+}
+
+void QgsAuthOAuth2Method::clearCachedConfig( const QString &authcfg )
+{
+  removeOAuth2Bundle( authcfg );
+}
+
+bool QgsAuthOAuth2Method::migrateTokenCache( const QString &authcfg, bool persist )
+{
+  // serialized with linking and refreshing, which write the token cache; a thread linking
+  // interactively may hold the authcfg's mutex for minutes, so retry shortly rather than wait
+  QSharedPointer<QMutex> authcfgmutex = authcfgMutex( authcfg );
+  if ( !authcfgmutex->tryLock() )
+  {
+    {
+      QMutexLocker locker( &mDeferredMigrationsMutex );
+      mDeferredMigrations.insert( authcfg, persist );
+    }
+    QgsDebugMsg( QStringLiteral( "Deferred token cache migration for busy authcfg: %1" ).arg( authcfg ) );
+    // the caller may be any thread, the timer lives in this object's
+    QMetaObject::invokeMethod( mMigrationRetryTimer, "start", Qt::AutoConnection );
+    return true;
+  }
+
+  {
+    // superseded by this migration
+    QMutexLocker locker( &mDeferredMigrationsMutex );
+    mDeferredMigrations.remove( authcfg );
+  }
+
+  QgsO2 *o2 = nullptr;
+  {
+    QMutexLocker bundleslocker( &mBundlesMutex );
+    o2 = mBundles.value( authcfg ).bundle;
+  }
+  bool migrated = false;
+  if ( !o2 )
+  {
+    migrated = QgsO2::moveTokenCache( authcfg, persist );
+  }
+  else
+  {
+    migrated = o2->migrateTokenCache( persist );
+
+    // otherwise the old cache file disappearing would drop the published token
+    if ( !tokenSnapshot( authcfg ).isNull() )
+    {
+      QMetaObject::invokeMethod( this, "watchTokenCache", Qt::AutoConnection,
+                                 Q_ARG( QString, authcfg ), Q_ARG( QString, o2->tokenCacheFile() ) );
+    }
+  }
+  authcfgmutex->unlock();
+  return migrated;
+}
+
+// slot
+void QgsAuthOAuth2Method::processDeferredTokenCacheMigrations()
+{
+  QHash<QString, bool> deferred;
+  {
+    QMutexLocker locker( &mDeferredMigrationsMutex );
+    deferred.swap( mDeferredMigrations );
+  }
+  QHash<QString, bool>::const_iterator it = deferred.constBegin();
+  for ( ; it != deferred.constEnd(); ++it )
+  {
+    // defers again while still busy
+    if ( !migrateTokenCache( it.key(), it.value() ) )
+    {
+      QgsDebugMsg( QStringLiteral( "FAILED deferred token cache migration for authcfg: %1" ).arg( it.key() ) );
+    }
+  }
+}
+
+QSharedPointer<QMutex> QgsAuthOAuth2Method::authcfgMutex( const QString &authcfg )
+{
+  QMutexLocker locker( &mAuthcfgMutexesMutex );
+  QSharedPointer<QMutex> mutex = mAuthcfgMutexes.value( authcfg );
+  if ( mutex.isNull() )
+  {
+    // entries are only dropped along with the authcfg's bundle, once no thread holds them
+    mutex = QSharedPointer<QMutex>( new QMutex() );
+    mAuthcfgMutexes.insert( authcfg, mutex );
+  }
+  return mutex;
+}
+
+QgsAuthOAuth2TokenSnapshot QgsAuthOAuth2Method::tokenSnapshot( const QString &authcfg ) const
+{
+  QReadLocker locker( &mTokenSnapshotsLock );
+  return mTokenSnapshots.value( authcfg );
+}
+
+QgsAuthOAuth2TokenSnapshot QgsAuthOAuth2Method::publishTokenSnapshot( const QString &authcfg, QgsO2 *o2 )
+{
+  QgsAuthOAuth2TokenSnapshot snapshot;
+  snapshot.setToken( o2->token() );
+  snapshot.expires = o2->expires();
+  snapshot.accessMethod = o2->oauth2config()->accessMethod();
+  snapshot.tokenCacheFile = o2->tokenCacheFile();
+
+  {
+    QWriteLocker locker( &mTokenSnapshotsLock );
+    // keep counting across refreshes, so summaries span token generations
+    snapshot.decorations = mTokenSnapshots.value( authcfg ).decorations;
+    if ( !snapshot.decorations )
+    {
+      snapshot.decorations = QSharedPointer<QAtomicInt>( new QAtomicInt( 0 ) );
+    }
+    mTokenSnapshots.insert( authcfg, snapshot );
+  }
+
+  // timers and watcher live in this object's thread; publishing may happen in any request thread
+  QMetaObject::invokeMethod( this, "scheduleTokenRefresh", Qt::AutoConnection,
+                             Q_ARG( QString, authcfg ),
+                             Q_ARG( int, snapshot.expires ),
+                             Q_ARG( int, o2->oauth2config()->refreshLeadTime() ) );
+  QMetaObject::invokeMethod( this, "watchTokenCache", Qt::AutoConnection,
+                             Q_ARG( QString, authcfg ),
+                             Q_ARG( QString, snapshot.tokenCacheFile ) );
+  return snapshot;
+}
+
+void QgsAuthOAuth2Method::setLogLevel( LogLevel level )
+{
+  mLogLevel = qBound( static_cast<int>( LogWarning ), static_cast<int>( level ), static_cast<int>( LogVerbose ) );
+}
+
+// slot
+void QgsAuthOAuth2Method::logRequestSummaries()
+{
+  if ( !logEnabled( LogInfo ) )
+  {
+    return;
+  }
+
+  QMap<QString, int> counts;
+  {
+    QReadLocker locker( &mTokenSnapshotsLock );
+    QHash<QString, QgsAuthOAuth2TokenSnapshot>::const_iterator it = mTokenSnapshots.constBegin();
+    for ( ; it != mTokenSnapshots.constEnd(); ++it )
+    {
+      if ( !it.value().decorations )
+      {
+        continue;
+      }
+      // counters only grow, as bundle cache sweeps read them too; a new counter starts at 0
+      int total = it.value().decorations->fetchAndAddRelaxed( 0 );
+      int logged = mLoggedDecorations.value( it.key(), 0 );
+      int count = total >= logged ? total - logged : total;
+      mLoggedDecorations.insert( it.key(), total );
+      if ( count > 0 )
+      {
+        counts.insert( it.key(), count );
+      }
+    }
+  }
+
+  QMap<QString, int>::const_iterator it = counts.constBegin();
+  for ( ; it != counts.constEnd(); ++it )
+  {
+    QString msg = QStringLiteral( "%1 requests decorated with access token for authcfg %2 in last %3 s" )
+                  .arg( it.value() ).arg( it.key() ).arg( LOG_SUMMARY_INTERVAL );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+  }
+}
+
+void QgsAuthOAuth2Method::clearTokenSnapshot( const QString &authcfg )
+{
+  QWriteLocker locker( &mTokenSnapshotsLock );
+  mTokenSnapshots.remove( authcfg );
+}
+
+// slot
+void QgsAuthOAuth2Method::watchTokenCache( const QString &authcfg, const QString &tokencachefile )
+{
+  // O2's settings store may not have synced a freshly linked token to disk yet
+  mWatchedTokenCaches.insert( authcfg, qMakePair( tokencachefile, QFile::exists( tokencachefile ) ) );
+}
+
+// slot
+void QgsAuthOAuth2Method::unwatchTokenCache( const QString &authcfg )
+{
+  mWatchedTokenCaches.remove( authcfg );
+}
+
+// slot
+void QgsAuthOAuth2Method::onTokenCacheDirectoryChanged( const QString &path )
+{
+  QStringList removed;
+  QHash<QString, QPair<QString, bool> >::iterator it = mWatchedTokenCaches.begin();
+  while ( it != mWatchedTokenCaches.end() )
+  {
+    const QString &tokencachefile = it.value().first;
+    if ( QFileInfo( tokencachefile ).absolutePath() != QDir( path ).absolutePath() )
+    {
+      ++it;
+      continue;
+    }
+    if ( QFile::exists( tokencachefile ) )
+    {
+      it.value().second = true;
+      ++it;
+      continue;
+    }
+    if ( it.value().second )
+    {
+      removed << it.key();
+    }
+    ++it;
+  }
+
+  Q_FOREACH ( const QString &authcfg, removed )
+  {
+    QString msg = QStringLiteral( "Token cache removed for authcfg %1: dropping published token" ).arg( authcfg );
+    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+
+    // the next request takes the slow path, which unlinks the authenticator
+    mWatchedTokenCaches.remove( authcfg );
+    clearTokenSnapshot( authcfg );
+    cancelTokenRefresh( authcfg );
+  }
+}
+
+// slot
+void QgsAuthOAuth2Method::collectTokenCacheGarbage()
 {
-  QMutexLocker locker( &mNetworkRequestMutex );
-  QString msg;
-  QNetworkReply *reply = qobject_cast<QNetworkReply *>( sender() );
-  if ( !reply )
+  if ( mTokenCacheGc.isRunning() )
   {
-    msg = tr( "Network error but no reply object accessible" );
-    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
     return;
   }
-  if ( err != QNetworkReply::NoError )
+
+  // caches are only known to be orphaned if the configs can be listed
+  if ( QgsAuthManager::instance()->isDisabled() )
   {
-    msg = tr( "Network error: %1" ).arg( reply->errorString() );
-    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    QgsDebugMsg( QStringLiteral( "Auth system disabled: skipping token cache garbage collection" ) );
+    return;
   }
+  QSet<QString> configids = QgsAuthManager::instance()->configIds().toSet();
 
-  // TODO: update debug messages to output to QGIS
-
-  int status = reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
-  msg = tr( "Network error, HTTP status: %1" ).arg(
-          reply->attribute( QNetworkRequest::HttpReasonPhraseAttribute ).toString() );
-  QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+  QSet<QString> liveauthcfgs;
+  {
+    QMutexLocker locker( &mBundlesMutex );
+    liveauthcfgs = mBundles.keys().toSet();
+  }
 
-  if ( status == 401 )
+  QString databasepath;
+  if ( QgsAuthOAuth2Config::tokenCacheDatabaseEnabled()
+       && QFile::exists( QgsAuthOAuth2Config::tokenCacheDatabasePath() ) )
   {
-    msg = tr( "Attempting token refresh..." );
-    QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+    databasepath = QgsAuthOAuth2Config::tokenCacheDatabasePath();
+  }
 
-    QString authcfg = reply->property( "authcfg" ).toString();
-    if ( authcfg.isEmpty() )
-    {
-      msg = tr( "Token refresh FAILED: authcfg empty" );
-      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
-      return;
-    }
+  TokenCacheCollector collector;
+  collector.tempDirPath = QgsAuthOAuth2Config::tokenCacheDirectory( true );
+  collector.persistentDirPath = QgsAuthOAuth2Config::tokenCacheDirectory( false );
+  collector.databasePath = databasepath;
+  collector.configIds = configids;
+  collector.liveAuthcfgs = liveauthcfgs;
+  collector.maxAge = mTokenCacheMaxAge;
+  mTokenCacheGc = QtConcurrent::run( collector );
+}
 
-    // get the cached authenticator
-    QgsO2 *o2 = getOAuth2Bundle( authcfg );
+// static
+int QgsAuthOAuth2Method::removeStaleTokenCaches( const QString &tempdirpath, const QString &persistentdirpath,
+    const QString &databasepath, const QSet<QString> &configids,
+    const QSet<QString> &liveauthcfgs, int maxage )
+{
+  int removed = 0;
+  QDateTime now( QDateTime::currentDateTime() );
+  qint64 session = QCoreApplication::applicationPid();
+  QString prefix( QgsAuthOAuth2Config::tokenCacheFile( QStringLiteral( "*" ) ).section( '*', 0, 0 ) );
+  QString suffix( QgsAuthOAuth2Config::tokenCacheFile( QStringLiteral( "*" ) ).section( '*', 1 ) );
 
-    if ( o2 )
+  for ( int i = 0; i < 2; ++i )
+  {
+    bool temporary = ( i == 0 );
+    QDir cachedir( temporary ? tempdirpath : persistentdirpath );
+    QFileInfoList cachefiles = cachedir.entryInfoList(
+                                 QStringList() << QgsAuthOAuth2Config::tokenCacheFile( QStringLiteral( "*" ) ),
+                                 QDir::Files | QDir::NoDotAndDotDot );
+    Q_FOREACH ( const QFileInfo &cachefile, cachefiles )
     {
-      // Call O2::refresh. Note the O2 instance might live in a different thread from reply,
-      // so don't block here. User will just have to re-attempt connection
-      o2->refresh();
+      QString authcfg = cachefile.fileName().mid( prefix.size() );
+      authcfg.chop( suffix.size() );
 
-      msg = tr( "Background token refresh underway for authcfg: %1" ).arg( authcfg );
-      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+      // temporary caches are named for their owning process, except those of earlier versions
+      qint64 owner = 0;
+      if ( temporary && authcfg.contains( '-' ) )
+      {
+        bool ok = false;
+        owner = authcfg.section( '-', -1 ).toLongLong( &ok );
+        if ( ok )
+        {
+          authcfg = authcfg.section( '-', 0, -2 );
+        }
+        else
+        {
+          owner = 0;
+        }
+      }
+
+      bool stale = false;
+      if ( owner > 0 && owner != session )
+      {
+        // another session's, even of a deleted authcfg, that may still be using it
+        stale = !processIsRunning( owner );
+      }
+      else if ( !liveauthcfgs.contains( authcfg ) )
+      {
+        stale = !configids.contains( authcfg )
+                || ( temporary && owner == 0 && cachefile.lastModified().secsTo( now ) >= maxage );
+      }
+      if ( !stale )
+      {
+        continue;
+      }
+      if ( QFile::remove( cachefile.filePath() ) )
+      {
+        ++removed;
+      }
+      else
+      {
+        QgsDebugMsg( QStringLiteral( "FAILED to delete stale token cache file: %1" ).arg( cachefile.filePath() ) );
+      }
     }
-    else
+  }
+
+  if ( !databasepath.isEmpty() )
+  {
+    // usually run on a pool thread
+    QgsO2TokenDatabase tokendb( databasepath, QgsO2TokenDatabase::OperationConnection );
+    Q_FOREACH ( const QString &authcfg, tokendb.authcfgs( false ) )
     {
-      msg = tr( "Background token refresh FAILED for authcfg %1: could not get authenticator object" ).arg( authcfg );
-      QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+      if ( !liveauthcfgs.contains( authcfg ) && !configids.contains( authcfg )
+           && tokendb.removeTokens( authcfg, false ) )
+      {
+        ++removed;
+      }
+    }
+
+    typedef QPair<QString, qint64> TokenCacheOwner;
+    Q_FOREACH ( const TokenCacheOwner &cache, tokendb.temporaryCacheOwners() )
+    {
+      bool stale = false;
+      if ( cache.second != session )
+      {
+        stale = !processIsRunning( cache.second );
+      }
+      else
+      {
+        stale = !liveauthcfgs.contains( cache.first ) && !configids.contains( cache.first );
+      }
+      if ( stale && tokendb.removeTemporaryTokens( cache.first, cache.second ) )
+      {
+        ++removed;
+      }
     }
   }
-}
 
-void QgsAuthOAuth2Method::onRefreshFinished( QNetworkReply::NetworkError err )
-{
-  QNetworkReply *reply = qobject_cast<QNetworkReply *>( sender() );
-  if ( err != QNetworkReply::NoError )
+  if ( removed > 0 )
   {
-    QgsMessageLog::logMessage( tr( "Token fefresh error: %1" ).arg( reply->errorString() ),
-                               AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    QgsDebugMsg( QStringLiteral( "Removed %1 stale token caches" ).arg( removed ) );
   }
+  return removed;
 }
 
-bool QgsAuthOAuth2Method::updateDataSourceUriItems( QStringList &connectionItems, const QString &authcfg,
-    const QString &dataprovider )
+// slot
+void QgsAuthOAuth2Method::scheduleTokenRefresh( const QString &authcfg, int expires, int leadtime )
 {
-  Q_UNUSED( connectionItems )
-  Q_UNUSED( authcfg )
-  Q_UNUSED( dataprovider )
+  if ( expires <= 0 )
+  {
+    // token does not expire
+    cancelTokenRefresh( authcfg );
+    return;
+  }
 
-  return true;
+  int cursecs = static_cast<int>( QDateTime::currentDateTime().toMSecsSinceEpoch() / 1000 );
+  int remaining = expires - cursecs;
+  int jitter = mRefreshJitter > 0 ? qrand() % ( mRefreshJitter + 1 ) : 0;
+
+  // for tokens shorter-lived than the lead time, refresh half way through their life instead
+  int delay = qMax( remaining - leadtime - jitter, remaining / 2 );
+  // keep within QTimer's range; the timer re-arms itself when it fires before the token is due
+  delay = qBound( 1, delay, 24 * 60 * 60 );
+
+  QTimer *timer = mRefreshTimers.value( authcfg, nullptr );
+  if ( !timer )
+  {
+    timer = new QTimer( this );
+    timer->setSingleShot( true );
+    timer->setProperty( "authcfg", authcfg );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+    connect( timer, SIGNAL( timeout() ), this, SLOT( onScheduledRefresh() ) );
+#else
+    connect( timer, &QTimer::timeout, this, &QgsAuthOAuth2Method::onScheduledRefresh );
+#endif
+    mRefreshTimers.insert( authcfg, timer );
+  }
+  timer->start( delay * 1000 );
+  QgsDebugMsg( QStringLiteral( "Scheduled background token refresh in %1 seconds for authcfg: %2" ).arg( delay ).arg( authcfg ) );
 }
 
-void QgsAuthOAuth2Method::updateMethodConfig( QgsAuthMethodConfig &mconfig )
+// slot
+void QgsAuthOAuth2Method::cancelTokenRefresh( const QString &authcfg )
 {
-  if ( mconfig.hasConfig( QStringLiteral( "oldconfigstyle" ) ) )
+  QTimer *timer = mRefreshTimers.take( authcfg );
+  if ( timer )
   {
-    QgsDebugMsg( QStringLiteral( "Updating old style auth method config" ) );
+    timer->stop();
+    timer->deleteLater();
   }
-
-  // NOTE: add updates as method version() increases due to config storage changes
 }
 
-void QgsAuthOAuth2Method::clearCachedConfig( const QString &authcfg )
+// slot
+void QgsAuthOAuth2Method::onScheduledRefresh()
 {
-  removeOAuth2Bundle( authcfg );
+  QTimer *timer = qobject_cast<QTimer *>( sender() );
+  if ( !timer )
+  {
+    return;
+  }
+  QString authcfg = timer->property( "authcfg" ).toString();
+
+  QgsO2 *o2 = cachedOAuth2Bundle( authcfg );
+  if ( !o2 || !o2->linked() )
+  {
+    cancelTokenRefresh( authcfg );
+    return;
+  }
+
+  int leadtime = o2->oauth2config()->refreshLeadTime();
+  int cursecs = static_cast<int>( QDateTime::currentDateTime().toMSecsSinceEpoch() / 1000 );
+  if ( o2->expires() - cursecs > leadtime + mRefreshJitter )
+  {
+    // fired early because of a clamped interval, or the token was already refreshed
+    scheduleTokenRefresh( authcfg, o2->expires(), leadtime );
+    return;
+  }
+
+  QString msg = QStringLiteral( "Background token refresh scheduled ahead of expiry for authcfg: %1" ).arg( authcfg );
+  QgsMessageLog::logMessage( msg, AUTH_METHOD_KEY, QgsMessageLog::INFO );
+
+  // asynchronous, joins any refresh already underway; onRefreshFinished() re-publishes and re-arms
+  o2->requestRefresh();
 }
 
 QgsO2 *QgsAuthOAuth2Method::getOAuth2Bundle( const QString &authcfg, bool fullconfig )
@@ -520,22 +1588,82 @@ QgsO2 *QgsAuthOAuth2Method::getOAuth2Bundle( const QString &authcfg, bool fullco
   // TODO: update to QgsMessageLog output where appropriate
 
   // check if it is cached
-  if ( sOAuth2ConfigCache.contains( authcfg ) )
+  QgsO2 *cachedbundle = cachedOAuth2Bundle( authcfg );
+  {
+    QMutexLocker locker( &mBundlesMutex );
+    if ( cachedbundle )
+    {
+      ++mBundleCacheHits;
+    }
+    else
+    {
+      ++mBundleCacheMisses;
+    }
+  }
+  if ( cachedbundle )
   {
     QgsDebugMsg( QStringLiteral( "Retrieving OAuth bundle for authcfg: %1" ).arg( authcfg ) );
-    return sOAuth2ConfigCache.value( authcfg );
+    return cachedbundle;
+  }
+
+  // fail fast for configs that recently failed to load, rather than reloading and reparsing
+  // them (and rescanning defined config directories) for every request of a broken layer
+  if ( bundleFailureCached( authcfg ) )
+  {
+    QgsDebugMsg( QStringLiteral( "Skipping OAuth bundle load for recently failed authcfg: %1" ).arg( authcfg ) );
+    return nullptr;
   }
 
+  QgsAuthOAuth2Config *config = loadOAuth2Config( authcfg, fullconfig );
+  if ( !config )
+  {
+    cacheBundleFailure( authcfg );
+    return nullptr;
+  }
+
+  QgsO2 *o2 = new QgsO2( authcfg, config, nullptr, QgsNetworkAccessManager::instance() );
+
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( o2, SIGNAL( linkedChanged() ), this, SLOT( onLinkedChanged() ), Qt::UniqueConnection );
+  connect( o2, SIGNAL( linkingFailed() ), this, SLOT( onLinkingFailed() ), Qt::UniqueConnection );
+  connect( o2, SIGNAL( linkingSucceeded() ), this, SLOT( onLinkingSucceeded() ), Qt::UniqueConnection );
+  connect( o2, SIGNAL( openBrowser( QUrl ) ), this, SLOT( onOpenBrowser( QUrl ) ), Qt::UniqueConnection );
+  connect( o2, SIGNAL( closeBrowser() ), this, SLOT( onCloseBrowser() ), Qt::UniqueConnection );
+#else
+  connect( o2, &QgsO2::linkedChanged, this, &QgsAuthOAuth2Method::onLinkedChanged, Qt::UniqueConnection );
+  connect( o2, &QgsO2::linkingFailed, this, &QgsAuthOAuth2Method::onLinkingFailed, Qt::UniqueConnection );
+  connect( o2, &QgsO2::linkingSucceeded, this, &QgsAuthOAuth2Method::onLinkingSucceeded, Qt::UniqueConnection );
+  connect( o2, &QgsO2::openBrowser, this, &QgsAuthOAuth2Method::onOpenBrowser, Qt::UniqueConnection );
+  connect( o2, &QgsO2::closeBrowser, this, &QgsAuthOAuth2Method::onCloseBrowser, Qt::UniqueConnection );
+#endif
+
+  // connected at creation, so refreshes of tokens restored from a persisted cache also invalidate snapshots
+  //qRegisterMetaType<QNetworkReply::NetworkError>( QStringLiteral( "QNetworkReply::NetworkError" )) // for Qt::QueuedConnection, if needed;
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( o2, SIGNAL( refreshFinished( QNetworkReply::NetworkError ) ),
+           this, SLOT( onRefreshFinished( QNetworkReply::NetworkError ) ), Qt::UniqueConnection );
+#else
+  connect( o2, &QgsO2::refreshFinished, this, &QgsAuthOAuth2Method::onRefreshFinished, Qt::UniqueConnection );
+#endif
+
+  // cache bundle
+  putOAuth2Bundle( authcfg, o2 );
+
+  return o2;
+}
+
+QgsAuthOAuth2Config *QgsAuthOAuth2Method::loadOAuth2Config( const QString &authcfg, bool fullconfig )
+{
   QgsAuthOAuth2Config *config = new QgsAuthOAuth2Config( );
-  QgsO2 *nullbundle =  nullptr;
+  QgsAuthOAuth2Config *nullconfig = nullptr;
 
-  // else build oauth2 config
+  // build oauth2 config
   QgsAuthMethodConfig mconfig;
   if ( !QgsAuthManager::instance()->loadAuthenticationConfig( authcfg, mconfig, fullconfig ) )
   {
     QgsDebugMsg( QStringLiteral( "Retrieve config FAILED for authcfg: %1" ).arg( authcfg ) );
     config->deleteLater();
-    return nullbundle;
+    return nullconfig;
   }
 
   QgsStringMap configmap = mconfig.configMap();
@@ -544,22 +1672,23 @@ QgsO2 *QgsAuthOAuth2Method::getOAuth2Bundle( const QString &authcfg, bool fullco
 
   if ( configmap.contains( QStringLiteral( "oauth2config" ) ) )
   {
-    QByteArray configtxt = configmap.value( QStringLiteral( "oauth2config" ) ).toUtf8();
+    QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::JSON;
+    QByteArray configtxt = QgsAuthOAuth2Config::configTxtFromStored( configmap.value( QStringLiteral( "oauth2config" ) ), &format );
     if ( configtxt.isEmpty() )
     {
       QgsDebugMsg( QStringLiteral( "FAILED to load OAuth2 config: empty config txt" ) );
       config->deleteLater();
-      return nullbundle;
+      return nullconfig;
     }
     //###################### DO NOT LEAVE ME UNCOMMENTED #####################
     //QgsDebugMsg( QStringLiteral( "LOAD oauth2config configtxt: \n\n%1\n\n" ).arg( QString( configtxt ) ) );
     //###################### DO NOT LEAVE ME UNCOMMENTED #####################
 
-    if ( !config->loadConfigTxt( configtxt, QgsAuthOAuth2Config::JSON ) )
+    if ( !config->loadConfigTxt( configtxt, format ) )
     {
       QgsDebugMsg( QStringLiteral( "FAILED to load OAuth2 config into object" ) );
       config->deleteLater();
-      return nullbundle;
+      return nullconfig;
     }
   }
   else if ( configmap.contains( QStringLiteral( "definedid" ) ) )
@@ -570,7 +1699,7 @@ QgsO2 *QgsAuthOAuth2Method::getOAuth2Bundle( const QString &authcfg, bool fullco
     {
       QgsDebugMsg( QStringLiteral( "FAILED to load a defined ID for OAuth2 config" ) );
       config->deleteLater();
-      return nullbundle;
+      return nullconfig;
     }
 
     QString extradir = configmap.value( QStringLiteral( "defineddirpath" ) );
@@ -579,29 +1708,17 @@ QgsO2 *QgsAuthOAuth2Method::getOAuth2Bundle( const QString &authcfg, bool fullco
       QgsDebugMsg( QStringLiteral( "No custom defined dir path to load OAuth2 config" ) );
     }
 
-    QgsStringMap definedcache = QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( this, extradir );
+    // only this ID is decoded when its directory has a precompiled bundle
+    QgsAuthOAuth2ConfigData defined = QgsAuthOAuth2Config::definedOAuth2Config( definedid, extradir, &ok );
 
-    if ( !definedcache.contains( definedid ) )
+    if ( !ok )
     {
       QgsDebugMsg( QStringLiteral( "FAILED to load OAuth2 config for defined ID: missing ID or file for %1" ).arg( definedid ) );
       config->deleteLater();
-      return nullbundle;
-    }
-
-    QByteArray definedtxt = definedcache.value( definedid ).toUtf8();
-    if ( definedtxt.isNull() || definedtxt.isEmpty() )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to load config text for defined ID: empty text for %1" ).arg( definedid ) );
-      config->deleteLater();
-      return nullbundle;
+      return nullconfig;
     }
 
-    if ( !config->loadConfigTxt( definedtxt, QgsAuthOAuth2Config::JSON ) )
-    {
-      QgsDebugMsg( QStringLiteral( "FAILED to load config text for defined ID: %1" ).arg( definedid ) );
-      config->deleteLater();
-      return nullbundle;
-    }
+    config->setData( defined );
 
     QByteArray querypairstxt = configmap.value( QStringLiteral( "querypairs" ) ).toUtf8();
     if ( !querypairstxt.isNull() && !querypairstxt.isEmpty() )
@@ -632,28 +1749,265 @@ QgsO2 *QgsAuthOAuth2Method::getOAuth2Bundle( const QString &authcfg, bool fullco
   QgsDebugMsg( QStringLiteral( "Loading authenticator object with %1 flow properties of OAuth2 config: %2" )
                .arg( QgsAuthOAuth2Config::grantFlowString( config->grantFlow() ), authcfg ) );
 
-  QgsO2 *o2 = new QgsO2( authcfg, config, nullptr, QgsNetworkAccessManager::instance() );
+  return config;
+}
 
-  // cache bundle
-  putOAuth2Bundle( authcfg, o2 );
+bool QgsAuthOAuth2Method::bundleFailureCached( const QString &authcfg )
+{
+  QMutexLocker locker( &mBundlesMutex );
+  QHash<QString, qint64>::iterator it = mFailedBundles.find( authcfg );
+  if ( it == mFailedBundles.end() )
+  {
+    return false;
+  }
+  if ( it.value() <= QDateTime::currentMSecsSinceEpoch() )
+  {
+    mFailedBundles.erase( it );
+    return false;
+  }
+  ++mBundleCacheFailedHits;
+  return true;
+}
 
-  return o2;
+void QgsAuthOAuth2Method::cacheBundleFailure( const QString &authcfg )
+{
+  if ( mFailedBundleTtl <= 0 )
+  {
+    return;
+  }
+  QMutexLocker locker( &mBundlesMutex );
+  mFailedBundles.insert( authcfg, QDateTime::currentMSecsSinceEpoch() + static_cast<qint64>( mFailedBundleTtl ) * 1000 );
+}
+
+QgsO2 *QgsAuthOAuth2Method::cachedOAuth2Bundle( const QString &authcfg )
+{
+  QMutexLocker locker( &mBundlesMutex );
+  QHash<QString, QgsAuthOAuth2BundleEntry>::iterator it = mBundles.find( authcfg );
+  if ( it == mBundles.end() )
+  {
+    return nullptr;
+  }
+  it.value().lastUsed = QDateTime::currentMSecsSinceEpoch();
+  return it.value().bundle;
 }
 
 void QgsAuthOAuth2Method::putOAuth2Bundle( const QString &authcfg, QgsO2 *bundle )
 {
   QgsDebugMsg( QStringLiteral( "Putting oauth2 bundle for authcfg: %1" ).arg( authcfg ) );
-  sOAuth2ConfigCache.insert( authcfg, bundle );
+  {
+    QMutexLocker locker( &mBundlesMutex );
+    QgsAuthOAuth2BundleEntry entry;
+    entry.bundle = bundle;
+    entry.lastUsed = QDateTime::currentMSecsSinceEpoch();
+    QgsO2 *replaced = mBundles.value( authcfg ).bundle;
+    if ( replaced && replaced != bundle )
+    {
+      replaced->deleteLater();
+    }
+    mBundles.insert( authcfg, entry );
+  }
+  trimOAuth2Bundles( authcfg );
 }
 
 void QgsAuthOAuth2Method::removeOAuth2Bundle( const QString &authcfg )
 {
-  if ( sOAuth2ConfigCache.contains( authcfg ) )
+  clearTokenSnapshot( authcfg );
+  QMetaObject::invokeMethod( this, "cancelTokenRefresh", Qt::AutoConnection, Q_ARG( QString, authcfg ) );
+  QMetaObject::invokeMethod( this, "unwatchTokenCache", Qt::AutoConnection, Q_ARG( QString, authcfg ) );
+
+  QMutexLocker locker( &mBundlesMutex );
+  // an edited config gets a fresh load attempt
+  mFailedBundles.remove( authcfg );
+  if ( mBundles.contains( authcfg ) )
   {
-    sOAuth2ConfigCache.value( authcfg )->deleteLater();
-    sOAuth2ConfigCache.remove( authcfg );
+    // deleting the bundle also deletes its config and token store
+    mBundles.take( authcfg ).bundle->deleteLater();
     QgsDebugMsg( QStringLiteral( "Removed oauth2 bundle for authcfg: %1" ).arg( authcfg ) );
   }
+  locker.unlock();
+
+  pruneAuthcfgMutex( authcfg );
+}
+
+void QgsAuthOAuth2Method::pruneAuthcfgMutex( const QString &authcfg )
+{
+  QMutexLocker locker( &mAuthcfgMutexesMutex );
+  QWeakPointer<QMutex> mutex( mAuthcfgMutexes.take( authcfg ) );
+
+  // a thread still holding it, e.g. linking the authcfg, must keep sharing it with later ones
+  QSharedPointer<QMutex> held( mutex.toStrongRef() );
+  if ( held )
+  {
+    mAuthcfgMutexes.insert( authcfg, held );
+  }
+}
+
+void QgsAuthOAuth2Method::setBundleCacheCapacity( int capacity )
+{
+  mBundleCacheCapacity = qMax( 1, capacity );
+}
+
+QgsAuthOAuth2BundleCacheStats QgsAuthOAuth2Method::bundleCacheStats() const
+{
+  QMutexLocker locker( &mBundlesMutex );
+  QgsAuthOAuth2BundleCacheStats stats;
+  stats.size = mBundles.size();
+  stats.capacity = mBundleCacheCapacity;
+  stats.hits = mBundleCacheHits;
+  stats.misses = mBundleCacheMisses;
+  stats.evictions = mBundleCacheEvictions;
+  stats.failedHits = mBundleCacheFailedHits;
+  return stats;
+}
+
+void QgsAuthOAuth2Method::touchDecoratedBundles()
+{
+  // requests on the fast path never look up their bundle, so count their decorations as use
+  QHash<QString, int> decorated;
+  {
+    QReadLocker locker( &mTokenSnapshotsLock );
+    QHash<QString, QgsAuthOAuth2TokenSnapshot>::const_iterator it = mTokenSnapshots.constBegin();
+    for ( ; it != mTokenSnapshots.constEnd(); ++it )
+    {
+      if ( it.value().decorations )
+      {
+        decorated.insert( it.key(), it.value().decorations->fetchAndAddRelaxed( 0 ) );
+      }
+    }
+  }
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  QMutexLocker locker( &mBundlesMutex );
+  QHash<QString, QgsAuthOAuth2BundleEntry>::iterator it = mBundles.begin();
+  for ( ; it != mBundles.end(); ++it )
+  {
+    int count = decorated.value( it.key(), it.value().seenDecorations );
+    if ( count != it.value().seenDecorations )
+    {
+      it.value().seenDecorations = count;
+      it.value().lastUsed = now;
+    }
+  }
+}
+
+bool QgsAuthOAuth2Method::bundleEvictable( const QString &authcfg, QgsO2 *bundle )
+{
+  // never pull a bundle out from under queued requests or a refresh in flight
+  if ( hasPendingRequests( authcfg ) || bundle->isRefreshing() )
+  {
+    return false;
+  }
+  // deleting a bundle removes its temporary token cache, so evicting a linked one would
+  // throw away a valid token and make the user log in again; keep it over capacity instead
+  return !( bundle->temporaryToken() && bundle->linked() );
+}
+
+bool QgsAuthOAuth2Method::evictOAuth2Bundle( const QString &authcfg )
+{
+  // a thread holding the authcfg's mutex may be linking or refreshing its bundle, which it
+  // got from getOAuth2Bundle() under that mutex; skip the bundle rather than wait for it
+  QSharedPointer<QMutex> authcfgmutex( authcfgMutex( authcfg ) );
+  if ( !authcfgmutex->tryLock() )
+  {
+    QgsDebugMsg( QStringLiteral( "Skipped evicting busy oauth2 bundle for authcfg: %1" ).arg( authcfg ) );
+    return false;
+  }
+
+  bool evict = false;
+  {
+    QMutexLocker locker( &mBundlesMutex );
+    // the bundle may have been replaced or taken into use since it was picked
+    evict = mBundles.contains( authcfg ) && bundleEvictable( authcfg, mBundles.value( authcfg ).bundle );
+    if ( evict )
+    {
+      ++mBundleCacheEvictions;
+    }
+  }
+  if ( evict )
+  {
+    QgsDebugMsg( QStringLiteral( "Evicting oauth2 bundle for authcfg: %1" ).arg( authcfg ) );
+    removeOAuth2Bundle( authcfg );
+  }
+  authcfgmutex->unlock();
+
+  // removeOAuth2Bundle() kept the mutex while it was held here
+  authcfgmutex.clear();
+  pruneAuthcfgMutex( authcfg );
+  return evict;
+}
+
+void QgsAuthOAuth2Method::trimOAuth2Bundles( const QString &keep )
+{
+  {
+    QMutexLocker locker( &mBundlesMutex );
+    if ( mBundles.size() <= mBundleCacheCapacity )
+    {
+      return;
+    }
+  }
+  touchDecoratedBundles();
+
+  QSet<QString> busy;
+  Q_FOREVER
+  {
+    QString lru;
+    {
+      QMutexLocker locker( &mBundlesMutex );
+      if ( mBundles.size() <= mBundleCacheCapacity )
+      {
+        return;
+      }
+      qint64 oldest = std::numeric_limits<qint64>::max();
+      QHash<QString, QgsAuthOAuth2BundleEntry>::const_iterator it = mBundles.constBegin();
+      for ( ; it != mBundles.constEnd(); ++it )
+      {
+        if ( it.key() != keep && !busy.contains( it.key() ) && it.value().lastUsed < oldest
+             && bundleEvictable( it.key(), it.value().bundle ) )
+        {
+          oldest = it.value().lastUsed;
+          lru = it.key();
+        }
+      }
+    }
+    if ( lru.isEmpty() )
+    {
+      // everything else is busy; go over capacity until the next sweep
+      return;
+    }
+    if ( !evictOAuth2Bundle( lru ) )
+    {
+      busy.insert( lru );
+    }
+  }
+}
+
+// slot
+void QgsAuthOAuth2Method::sweepOAuth2Bundles()
+{
+  touchDecoratedBundles();
+
+  if ( mBundleIdleTimeout > 0 )
+  {
+    qint64 idlebefore = QDateTime::currentMSecsSinceEpoch() - static_cast<qint64>( mBundleIdleTimeout ) * 1000;
+    QStringList idle;
+    {
+      QMutexLocker locker( &mBundlesMutex );
+      QHash<QString, QgsAuthOAuth2BundleEntry>::const_iterator it = mBundles.constBegin();
+      for ( ; it != mBundles.constEnd(); ++it )
+      {
+        if ( it.value().lastUsed < idlebefore && bundleEvictable( it.key(), it.value().bundle ) )
+        {
+          idle << it.key();
+        }
+      }
+    }
+    Q_FOREACH ( const QString &authcfg, idle )
+    {
+      evictOAuth2Bundle( authcfg );
+    }
+  }
+
+  trimOAuth2Bundles();
 }
 
 
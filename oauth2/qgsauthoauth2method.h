@@ -17,16 +17,117 @@
 #define QGSAUTHOAUTH2METHOD_H
 
 #include <QObject>
+#include <QAtomicInt>
 #include <QDialog>
 #include <QEventLoop>
+#include <QFileSystemWatcher>
+#include <QFuture>
+#include <QHash>
 #include <QTimer>
 #include <QMutex>
+#include <QNetworkRequest>
+#include <QPointer>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QSharedPointer>
 
 #include "qgsauthmethod.h"
+#include "qgsauthoauth2config.h"
 
 
 class QgsO2;
 
+/**
+ * Copy of a linked authenticator's token state, published per authcfg, so
+ * requests can be decorated without entering the network request mutex.
+ * Snapshots are never modified once published, only replaced or cleared.
+ */
+class QgsAuthOAuth2TokenSnapshot
+{
+  public:
+    QgsAuthOAuth2TokenSnapshot()
+      : expires( 0 )
+      , accessMethod( QgsAuthOAuth2Config::Header )
+    {}
+
+    bool isNull() const { return token.isEmpty(); }
+
+    //! Set the access token, encoding it once for every request it will decorate
+    void setToken( const QString &accesstoken );
+
+    QString token;
+    QByteArray authorizationHeader; // Bearer header value
+    QByteArray queryItem; // percent encoded access_token query item
+    int expires; // seconds since epoch, 0 for tokens with no expiration
+    QgsAuthOAuth2Config::AccessMethod accessMethod;
+    QString tokenCacheFile;
+    // requests decorated since the last log summary, shared by all snapshots of an authcfg
+    QSharedPointer<QAtomicInt> decorations;
+};
+
+/**
+ * Network request waiting on its authcfg's access token, as handed out by
+ * QgsAuthOAuth2Method::updateNetworkRequestAsync(). The caller owns it and keeps it
+ * until finished() is emitted, always in the thread that asked for the decoration.
+ */
+class QgsAuthOAuth2PendingRequest : public QObject
+{
+    Q_OBJECT
+
+  public:
+    explicit QgsAuthOAuth2PendingRequest( const QNetworkRequest &request, const QString &authcfg,
+                                          QObject *parent = nullptr );
+
+    //! Request, decorated with the access token once finished successfully
+    QNetworkRequest request() const;
+
+    QString authcfg() const { return mAuthcfg; }
+
+    bool isFinished() const;
+
+    bool succeeded() const;
+
+  signals:
+    void finished( bool ok );
+
+  private slots:
+    void emitFinished();
+
+  private:
+    void settle( const QNetworkRequest &request, bool ok );
+
+    QNetworkRequest mRequest;
+    QString mAuthcfg;
+    bool mFinished;
+    bool mSucceeded;
+    mutable QMutex mMutex;
+
+    friend class QgsAuthOAuth2Method;
+};
+
+/**
+ * Counters of an OAuth2 method's authenticator bundle cache
+ */
+class QgsAuthOAuth2BundleCacheStats
+{
+  public:
+    QgsAuthOAuth2BundleCacheStats()
+      : size( 0 )
+      , capacity( 0 )
+      , hits( 0 )
+      , misses( 0 )
+      , evictions( 0 )
+      , failedHits( 0 )
+    {}
+
+    int size;
+    int capacity;
+    qint64 hits;
+    qint64 misses;
+    qint64 evictions;
+    qint64 failedHits; // lookups answered by a cached load failure
+};
+
 class QgsAuthOAuth2Method : public QgsAuthMethod
 {
     Q_OBJECT
@@ -45,6 +146,14 @@ class QgsAuthOAuth2Method : public QgsAuthMethod
     bool updateNetworkRequest( QNetworkRequest &request, const QString &authcfg,
                                const QString &dataprovider = QString() ) override;
 
+    /**
+     * Decorate a request without blocking the calling thread. The returned request is
+     * finished right away when a valid token is published, otherwise it is queued until
+     * the authcfg is linked or refreshed. Caller takes ownership.
+     */
+    QgsAuthOAuth2PendingRequest *updateNetworkRequestAsync( const QNetworkRequest &request, const QString &authcfg,
+        const QString &dataprovider = QString() );
+
     bool updateNetworkReply( QNetworkReply *reply, const QString &authcfg,
                              const QString &dataprovider ) override;
 
@@ -55,6 +164,77 @@ class QgsAuthOAuth2Method : public QgsAuthMethod
 
     void updateMethodConfig( QgsAuthMethodConfig &mconfig ) override;
 
+    /**
+     * Move an authcfg's cached tokens between the persistent and temporary token caches,
+     * e.g. when its config's token persistence is changed. A live authenticator keeps its
+     * tokens and persists to the new cache from then on, so it does not need relinking.
+     * While another thread links or refreshes the authcfg, the move is deferred until it is
+     * done and true is returned; a deferred move that then fails is only logged.
+     */
+    bool migrateTokenCache( const QString &authcfg, bool persist );
+
+    //! Plugin message verbosity, from least to most chatty
+    enum LogLevel
+    {
+      LogWarning = 0, //!< Only warnings and failures
+      LogInfo = 1,    //!< Plus linking/refresh events and periodic per-authcfg request summaries
+      LogVerbose = 2  //!< Plus a message for every decorated request and reply
+    };
+
+    /**
+     * Message verbosity, initially from the oauth2/logLevel setting. Checked before
+     * any hot path message is formatted, so suppressed messages cost nothing.
+     */
+    LogLevel logLevel() const { return static_cast<LogLevel>( mLogLevel ); }
+    void setLogLevel( LogLevel level );
+
+    /**
+     * Maximum number of authenticator bundles kept, initially from the oauth2/bundleCacheCapacity
+     * setting. Least recently used bundles are evicted first, skipping any still linking or refreshing,
+     * and linked ones whose tokens are not persisted, which would otherwise have to link again.
+     */
+    int bundleCacheCapacity() const { return mBundleCacheCapacity; }
+    void setBundleCacheCapacity( int capacity );
+
+    /**
+     * Seconds after which an unused bundle is evicted, initially from the oauth2/bundleIdleTimeout
+     * setting; 0 keeps bundles until over capacity.
+     */
+    int bundleIdleTimeout() const { return mBundleIdleTimeout; }
+    void setBundleIdleTimeout( int seconds ) { mBundleIdleTimeout = qMax( 0, seconds ); }
+
+    /**
+     * Seconds a failed bundle load is remembered for, initially from the oauth2/failedBundleTtl
+     * setting; 0 retries on every request. clearCachedConfig() forgets a failure right away.
+     */
+    int failedBundleTtl() const { return mFailedBundleTtl; }
+    void setFailedBundleTtl( int seconds ) { mFailedBundleTtl = qMax( 0, seconds ); }
+
+    QgsAuthOAuth2BundleCacheStats bundleCacheStats() const;
+
+    /**
+     * Seconds after which a temporary token cache file of an earlier version, not named for its
+     * owning process, is stale if not written to since, initially from the oauth2/tokenCacheMaxAge
+     * setting. Tokens are rewritten on each refresh, so a live session's caches stay younger than this.
+     */
+    int tokenCacheMaxAge() const { return mTokenCacheMaxAge; }
+    void setTokenCacheMaxAge( int seconds ) { mTokenCacheMaxAge = qMax( 0, seconds ); }
+
+    /**
+     * Remove token caches, in the given cache directories and optional token database, that are
+     * temporary caches of sessions whose process is gone, or of this session or persistent and of
+     * an authcfg not in \a configids. Temporary cache files of earlier versions, without an owning
+     * process, are also removed once older than \a maxage seconds. This session's caches of
+     * \a liveauthcfgs are kept. Returns the number of caches removed.
+     */
+    static int removeStaleTokenCaches( const QString &tempdirpath, const QString &persistentdirpath,
+                                       const QString &databasepath, const QSet<QString> &configids,
+                                       const QSet<QString> &liveauthcfgs, int maxage );
+
+    //! Maximum random seconds subtracted from a config's refresh lead time, to spread background refreshes
+    int refreshJitter() const { return mRefreshJitter; }
+    void setRefreshJitter( int seconds ) { mRefreshJitter = seconds; }
+
   public slots:
     void onLinkedChanged();
     void onLinkingFailed();
@@ -66,20 +246,170 @@ class QgsAuthOAuth2Method : public QgsAuthMethod
     void onNetworkError( QNetworkReply::NetworkError err );
     void onRefreshFinished( QNetworkReply::NetworkError err );
 
+  private slots:
+    void logRequestSummaries();
+
+    void sweepOAuth2Bundles();
+
+    void processPendingRequests( const QString &authcfg );
+    void processDeferredPendingRequests();
+    void processDeferredTokenCacheMigrations();
+    void onPendingRequestsTimeout();
+
+    void scheduleTokenRefresh( const QString &authcfg, int expires, int leadtime );
+    void cancelTokenRefresh( const QString &authcfg );
+    void onScheduledRefresh();
+
+    void watchTokenCache( const QString &authcfg, const QString &tokencachefile );
+    void unwatchTokenCache( const QString &authcfg );
+    void onTokenCacheDirectoryChanged( const QString &path );
+
+    //! Start removing stale token caches off this thread, e.g. those left behind by crashed sessions
+    void collectTokenCacheGarbage();
+
   private:
     QString mTempStorePath;
 
+    bool logEnabled( LogLevel level ) const { return level <= mLogLevel; }
+
+    //! Link or refresh in the calling thread, for callers other than this object's thread
+    bool updateNetworkRequestInThread( QNetworkRequest &request, const QString &authcfg );
+
+    //! Wait in a local event loop until a request is finished or \a msecs have passed; returns whether it succeeded
+    static bool waitForPendingRequest( QgsAuthOAuth2PendingRequest *pending, int msecs );
+
+    //! Msecs queued requests wait for a link or refresh of an authcfg
+    int pendingTimeout( const QString &authcfg );
+
+    /**
+     * Start a link or refresh for the requests queued for an authcfg, with its lock held.
+     * Returns whether they can be released right away, rather than once it is done.
+     */
+    bool startPendingRequests( const QString &authcfg );
+
+    //! Decorate and finish all requests queued for an authcfg, with its current token, if any
+    void releasePendingRequests( const QString &authcfg );
+
+    bool hasPendingRequests( const QString &authcfg );
+
+    void startPendingTimeout( const QString &authcfg, int msecs );
+    void stopPendingTimeout( const QString &authcfg );
+
+    bool decorateRequest( QNetworkRequest &request, const QString &authcfg,
+                          const QgsAuthOAuth2TokenSnapshot &snapshot );
+
+    //! Access token a request was decorated with, if any
+    static QString requestToken( const QNetworkRequest &request );
+
+    QgsAuthOAuth2TokenSnapshot tokenSnapshot( const QString &authcfg ) const;
+
+    QgsAuthOAuth2TokenSnapshot publishTokenSnapshot( const QString &authcfg, QgsO2 *o2 );
+
+    void clearTokenSnapshot( const QString &authcfg );
+
     QgsO2 *getOAuth2Bundle( const QString &authcfg, bool fullconfig = true );
 
+    //! Load an authcfg's OAuth2 config from the auth database, or a defined config; null on failure
+    QgsAuthOAuth2Config *loadOAuth2Config( const QString &authcfg, bool fullconfig );
+
+    bool bundleFailureCached( const QString &authcfg );
+
+    void cacheBundleFailure( const QString &authcfg );
+
+    QgsO2 *cachedOAuth2Bundle( const QString &authcfg );
+
     void putOAuth2Bundle( const QString &authcfg, QgsO2 *bundle );
 
     void removeOAuth2Bundle( const QString &authcfg );
 
-    static QMap<QString, QgsO2 *> sOAuth2ConfigCache;
+    //! Mark bundles whose published tokens decorated requests since the last check as used
+    void touchDecoratedBundles();
+
+    bool bundleEvictable( const QString &authcfg, QgsO2 *bundle );
+
+    //! Evict the bundle for \a authcfg, unless a thread holds its authcfg mutex; returns whether it was evicted
+    bool evictOAuth2Bundle( const QString &authcfg );
+
+    //! Evict least recently used bundles while over capacity, other than \a keep
+    void trimOAuth2Bundles( const QString &keep = QString() );
+
+    class QgsAuthOAuth2BundleEntry
+    {
+      public:
+        QgsAuthOAuth2BundleEntry()
+          : bundle( nullptr )
+          , lastUsed( 0 )
+          , seenDecorations( 0 )
+        {}
+
+        QgsO2 *bundle;
+        qint64 lastUsed; // msecs since epoch
+        int seenDecorations;
+    };
+
+    QHash<QString, QgsAuthOAuth2BundleEntry> mBundles;
+    mutable QMutex mBundlesMutex;
+    int mBundleCacheCapacity;
+    int mBundleIdleTimeout;
+    qint64 mBundleCacheHits;
+    qint64 mBundleCacheMisses;
+    qint64 mBundleCacheEvictions;
+    qint64 mBundleCacheFailedHits;
+    // msecs since epoch until which an authcfg's failed load is reused
+    QHash<QString, qint64> mFailedBundles;
+    int mFailedBundleTtl;
+    QTimer *mBundleSweepTimer;
 
     QgsO2 *authO2( const QString &authcfg );
 
-    QMutex mNetworkRequestMutex;
+    /**
+     * Mutex serializing link and refresh state changes for a single authcfg's bundle. Callers
+     * blocking outside of the method's thread link and refresh under it, while the method's
+     * thread only ever tries it, so neither waits on the other's event loop.
+     */
+    QSharedPointer<QMutex> authcfgMutex( const QString &authcfg );
+
+    //! Drop an authcfg's mutex, e.g. along with its bundle, unless a thread still holds it
+    void pruneAuthcfgMutex( const QString &authcfg );
+
+    QHash<QString, QSharedPointer<QMutex> > mAuthcfgMutexes;
+    QMutex mAuthcfgMutexesMutex;
+
+    // requests waiting on a link or refresh, per authcfg; an entry means one is underway
+    QHash<QString, QList< QPointer<QgsAuthOAuth2PendingRequest> > > mPendingRequests;
+    QMutex mPendingRequestsMutex;
+    // only touched from this object's thread
+    QHash<QString, QTimer *> mPendingTimeouts;
+    QSet<QString> mPendingRefreshes;
+    // authcfgs whose queued requests wait on a caller thread's link or refresh
+    QSet<QString> mDeferredPendingRequests;
+
+    // token cache moves waiting on a caller thread's link or refresh, per authcfg: whether to persist
+    QHash<QString, bool> mDeferredMigrations;
+    QMutex mDeferredMigrationsMutex;
+    QTimer *mMigrationRetryTimer;
+
+    QHash<QString, QgsAuthOAuth2TokenSnapshot> mTokenSnapshots;
+    mutable QReadWriteLock mTokenSnapshotsLock;
+
+    // background refresh timers, per authcfg, only touched from this object's thread
+    QHash<QString, QTimer *> mRefreshTimers;
+    int mRefreshJitter;
+
+    // token cache files of published snapshots, and whether each has yet been written to disk,
+    // so external removal is noticed without stat'ing the file for every request
+    QFileSystemWatcher *mTokenCacheWatcher;
+    QHash<QString, QPair<QString, bool> > mWatchedTokenCaches;
+
+    int mTokenCacheMaxAge;
+    QFuture<int> mTokenCacheGc;
+
+    int mLogLevel;
+    QTimer *mLogSummaryTimer;
+    // decoration counts already reported, per authcfg, only touched from this object's thread
+    QHash<QString, int> mLoggedDecorations;
+
+    friend class TestQgsAuthOAuth2Method;
 };
 
 #endif // QGSAUTHOAUTH2METHOD_H
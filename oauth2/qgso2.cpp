@@ -16,14 +16,21 @@
 
 #include "o0globals.h"
 #include "o0settingsstore.h"
+#include "qgso2tokendatabase.h"
+#include "qgso2tokenstore.h"
 #include "qgsapplication.h"
 #include "qgsauthoauth2config.h"
 #include "qgslogger.h"
+#include "qgsnetworkaccessmanager.h"
 
 #include <QDir>
+#include <QMutexLocker>
 #include <QSettings>
+#include <QTimer>
 #include <QUrl>
 
+#include <stdio.h>
+
 
 QgsO2::QgsO2( const QString &authcfg, QgsAuthOAuth2Config *oauth2config,
               QObject *parent, QNetworkAccessManager *manager )
@@ -31,18 +38,53 @@ QgsO2::QgsO2( const QString &authcfg, QgsAuthOAuth2Config *oauth2config,
   , mTokenCacheFile( QString::null )
   , mAuthcfg( authcfg )
   , mOAuth2Config( oauth2config )
+  , mTokenStore( nullptr )
+  , mTokenDatabase( false )
+  , mTemporaryToken( true )
+  , mRefreshing( false )
+  , mLinking( false )
+  , mNetworkManager( qobject_cast<QgsNetworkAccessManager *>( manager ) )
 {
+  // the bundle owns its config, so evicting it from the method's cache frees both
+  if ( mOAuth2Config && !mOAuth2Config->parent() )
+  {
+    mOAuth2Config->setParent( this );
+  }
+
   initOAuthConfig();
+
+  // direct, so the in-flight state settles before any other receiver of the signal runs
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( this, SIGNAL( refreshFinished( QNetworkReply::NetworkError ) ),
+           this, SLOT( onRefreshSettled( QNetworkReply::NetworkError ) ), Qt::DirectConnection );
+  connect( this, SIGNAL( linkingSucceeded() ), this, SLOT( onLinkSettled() ), Qt::DirectConnection );
+  connect( this, SIGNAL( linkingFailed() ), this, SLOT( onLinkSettled() ), Qt::DirectConnection );
+#else
+  connect( this, &QgsO2::refreshFinished, this, &QgsO2::onRefreshSettled, Qt::DirectConnection );
+  connect( this, &QgsO2::linkingSucceeded, this, &QgsO2::onLinkSettled, Qt::DirectConnection );
+  connect( this, &QgsO2::linkingFailed, this, &QgsO2::onLinkSettled, Qt::DirectConnection );
+#endif
 }
 
 QgsO2::~QgsO2()
 {
-  // FIXME: This crashes app on QgsApplication destruction
-  //        Verify that objects are actually being deleted via QgsAuthManager's destruction
-  //mOAuth2Config->deleteLater();
+  // mOAuth2Config and the token store are children, deleted along with this object
+
+  // token values still being written behind would otherwise recreate a removed cache
+  if ( mTokenStore )
+  {
+    mTokenStore->sync();
+  }
 
-  if ( mTokenCacheFile.startsWith( QgsAuthOAuth2Config::tokenCacheDirectory( true ) )
-       && QFile::exists( mTokenCacheFile ) )
+  if ( mTokenDatabase )
+  {
+    if ( mTemporaryToken && !QgsO2TokenDatabase( mTokenCacheFile ).removeTokens( mAuthcfg, true ) )
+    {
+      QgsDebugMsg( QStringLiteral( "Could not remove temp tokens from database for authcfg: %1" ).arg( mAuthcfg ) );
+    }
+  }
+  else if ( mTokenCacheFile.startsWith( QgsAuthOAuth2Config::tokenCacheDirectory( true ) )
+            && QFile::exists( mTokenCacheFile ) )
   {
     if ( !QFile::remove( mTokenCacheFile ) )
     {
@@ -108,12 +150,126 @@ void QgsO2::initOAuthConfig()
 
 void QgsO2::setSettingsStore( bool persist )
 {
-  mTokenCacheFile = QgsAuthOAuth2Config::tokenCachePath( mAuthcfg, !persist );
+  mTemporaryToken = !persist;
+  QgsO2TokenCommitter *committer = nullptr;
+  O0AbstractStore *backing = createTokenBackingStore( &committer );
+
+  // token accessors are called several times per request; only the first read of each
+  // value goes to the backing store (and is decrypted), while the values of a new token
+  // are written behind, together, so refreshes neither block on disk nor tear the cache
+  mTokenStore = new QgsO2TokenStore( backing );
+  mTokenStore->setCommitter( committer );
+  setStore( mTokenStore );
+}
+
+O0AbstractStore *QgsO2::createTokenBackingStore( QgsO2TokenCommitter **committer )
+{
+  if ( QgsAuthOAuth2Config::tokenCacheDatabaseEnabled() )
+  {
+    // one row per token value, shared with all other authcfgs
+    mTokenCacheFile = QgsAuthOAuth2Config::tokenCacheDatabasePath();
+    mTokenDatabase = true;
+    *committer = new QgsO2DatabaseCommitter( mAuthcfg, mTemporaryToken, mTokenCacheFile );
+    return new QgsO2DatabaseStore( mAuthcfg, mTemporaryToken, mTokenCacheFile );
+  }
+
+  mTokenCacheFile = QgsAuthOAuth2Config::tokenCachePath( mAuthcfg, mTemporaryToken );
+  mTokenDatabase = false;
 
+  QString groupkey = QStringLiteral( "authcfg_%1" ).arg( mAuthcfg );
   QSettings *settings = new QSettings( mTokenCacheFile, QSettings::IniFormat );
-  O0SettingsStore *store = new O0SettingsStore( settings, O2_ENCRYPTION_KEY );
-  store->setGroupKey( QStringLiteral( "authcfg_%1" ).arg( mAuthcfg ) );
-  setStore( store );
+  O0SettingsStore *settingsstore = new O0SettingsStore( settings, O2_ENCRYPTION_KEY );
+  settingsstore->setGroupKey( groupkey );
+  *committer = new QgsO2SettingsCommitter( mTokenCacheFile, groupkey );
+  return settingsstore;
+}
+
+// static
+bool QgsO2::moveTokenCache( const QString &authcfg, bool persist )
+{
+  if ( QgsAuthOAuth2Config::tokenCacheDatabaseEnabled() )
+  {
+    return QgsO2TokenDatabase().moveTokens( authcfg, !persist );
+  }
+
+  QString fromfile = QgsAuthOAuth2Config::tokenCachePath( authcfg, persist );
+  QString tofile = QgsAuthOAuth2Config::tokenCachePath( authcfg, !persist );
+  if ( !QFile::exists( fromfile ) )
+  {
+    // nothing cached in the other cache; a leftover here is stale
+    if ( QFile::exists( tofile ) && !QFile::remove( tofile ) )
+    {
+      QgsDebugMsg( QStringLiteral( "FAILED to delete stale token cache file: %1" ).arg( tofile ) );
+      return false;
+    }
+    return true;
+  }
+
+  // rename(2) replaces the target in one step, where both are on the same file system
+  if ( ::rename( QFile::encodeName( fromfile ).constData(), QFile::encodeName( tofile ).constData() ) == 0 )
+  {
+    return true;
+  }
+
+  // otherwise copy beside the target, so it is only replaced once completely written,
+  // and remove the source last, so the tokens always exist in one of the caches
+  QString tmpfile( tofile + QStringLiteral( ".tmp" ) );
+  QFile::remove( tmpfile );
+  if ( !QFile::copy( fromfile, tmpfile ) )
+  {
+    QgsDebugMsg( QStringLiteral( "FAILED to copy token cache file: %1 -> %2" ).arg( fromfile, tmpfile ) );
+    QFile::remove( tmpfile );
+    return false;
+  }
+  QFile::setPermissions( tmpfile, QFile::ReadOwner | QFile::WriteOwner );
+  if ( ::rename( QFile::encodeName( tmpfile ).constData(), QFile::encodeName( tofile ).constData() ) != 0 )
+  {
+    // e.g. on Windows, where the target is not replaced
+    if ( ( QFile::exists( tofile ) && !QFile::remove( tofile ) ) || !QFile::rename( tmpfile, tofile ) )
+    {
+      QgsDebugMsg( QStringLiteral( "FAILED to replace token cache file: %1" ).arg( tofile ) );
+      QFile::remove( tmpfile );
+      return false;
+    }
+  }
+  if ( !QFile::remove( fromfile ) )
+  {
+    QgsDebugMsg( QStringLiteral( "FAILED to delete moved token cache file: %1" ).arg( fromfile ) );
+  }
+  return true;
+}
+
+bool QgsO2::migrateTokenCache( bool persist )
+{
+  if ( !mTokenStore )
+  {
+    return moveTokenCache( mAuthcfg, persist );
+  }
+
+  // values still being written behind would otherwise land in the cache moved away from
+  mTokenStore->sync();
+
+  bool moved = true;
+  if ( mTemporaryToken == persist )
+  {
+    moved = moveTokenCache( mAuthcfg, persist );
+  }
+
+  mTemporaryToken = !persist;
+  if ( mOAuth2Config && mOAuth2Config->persistToken() != persist )
+  {
+    mOAuth2Config->setPersistToken( persist );
+  }
+
+  // the tokens held in memory stay valid; only where they are persisted changes
+  QgsO2TokenCommitter *committer = nullptr;
+  O0AbstractStore *backing = createTokenBackingStore( &committer );
+  mTokenStore->setBackingStore( backing, committer, !moved );
+  if ( !moved )
+  {
+    QgsDebugMsg( QStringLiteral( "Token cache not moved for authcfg %1: handed over tokens held in memory" ).arg( mAuthcfg ) );
+  }
+  return true;
 }
 
 void QgsO2::setVerificationResponseContent()
@@ -130,3 +286,139 @@ void QgsO2::clearProperties()
 {
   // TODO: clear object properties
 }
+
+bool QgsO2::isRefreshing() const
+{
+  QMutexLocker locker( &mRefreshMutex );
+  return mRefreshing;
+}
+
+// slot
+bool QgsO2::requestRefresh()
+{
+  {
+    QMutexLocker locker( &mRefreshMutex );
+    if ( mRefreshing )
+    {
+      QgsDebugMsg( QStringLiteral( "Joining token refresh already underway for authcfg: %1" ).arg( mAuthcfg ) );
+      return true;
+    }
+    mRefreshing = true;
+  }
+
+  watchTokenRequests( true );
+
+  // O2 emits refreshFinished() synchronously if, e.g., there is no refresh token
+  refresh();
+
+  return isRefreshing();
+}
+
+// slot
+void QgsO2::onRefreshSettled( QNetworkReply::NetworkError err )
+{
+  Q_UNUSED( err )
+  {
+    QMutexLocker locker( &mRefreshMutex );
+    mRefreshing = false;
+    if ( mLinking )
+    {
+      return;
+    }
+  }
+  watchTokenRequests( false );
+}
+
+// slot
+void QgsO2::link()
+{
+  {
+    QMutexLocker locker( &mRefreshMutex );
+    mLinking = true;
+  }
+  watchTokenRequests( true );
+
+  // O2 emits linkingSucceeded() synchronously if already linked
+  O2::link();
+}
+
+// slot
+void QgsO2::onLinkSettled()
+{
+  {
+    QMutexLocker locker( &mRefreshMutex );
+    mLinking = false;
+    if ( mRefreshing )
+    {
+      return;
+    }
+  }
+  watchTokenRequests( false );
+}
+
+void QgsO2::watchTokenRequests( bool watch )
+{
+  // replies are only announced by QGIS's manager; others keep their own timeouts
+  if ( !mNetworkManager )
+  {
+    return;
+  }
+
+  // only while this authenticator calls its token endpoint, as every request is announced
+  if ( watch )
+  {
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+    connect( mNetworkManager, SIGNAL( requestCreated( QNetworkReply * ) ),
+             this, SLOT( onRequestCreated( QNetworkReply * ) ), Qt::UniqueConnection );
+#else
+    connect( mNetworkManager.data(), &QgsNetworkAccessManager::requestCreated,
+             this, &QgsO2::onRequestCreated, Qt::UniqueConnection );
+#endif
+  }
+  else
+  {
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+    disconnect( mNetworkManager, SIGNAL( requestCreated( QNetworkReply * ) ),
+                this, SLOT( onRequestCreated( QNetworkReply * ) ) );
+#else
+    disconnect( mNetworkManager.data(), &QgsNetworkAccessManager::requestCreated,
+                this, &QgsO2::onRequestCreated );
+#endif
+  }
+}
+
+bool QgsO2::isTokenRequest( const QNetworkRequest &request ) const
+{
+  if ( !mOAuth2Config )
+  {
+    return false;
+  }
+  QString url = request.url().toString( QUrl::RemoveQuery | QUrl::RemoveFragment );
+  QString tokenurl = QUrl( mOAuth2Config->tokenUrl() ).toString( QUrl::RemoveQuery | QUrl::RemoveFragment );
+  QString refreshurl = QUrl( mOAuth2Config->refreshTokenUrl() ).toString( QUrl::RemoveQuery | QUrl::RemoveFragment );
+  return ( !tokenurl.isEmpty() && url == tokenurl ) || ( !refreshurl.isEmpty() && url == refreshurl );
+}
+
+// slot
+void QgsO2::onRequestCreated( QNetworkReply *reply )
+{
+  if ( !reply || !isTokenRequest( reply->request() ) )
+  {
+    return;
+  }
+
+  // a timer of the reply's own, so token endpoint calls get this config's timeout without
+  // changing the global network timeout, which still applies as well, for all other traffic
+  int reqtimeout = ( mOAuth2Config ? mOAuth2Config->requestTimeout() : 30 ) * 1000;
+  QTimer *timer = new QTimer( reply );
+  timer->setSingleShot( true );
+#if QT_VERSION < QT_VERSION_CHECK( 5, 0, 0 )
+  connect( timer, SIGNAL( timeout() ), reply, SLOT( abort() ) );
+  connect( reply, SIGNAL( finished() ), timer, SLOT( stop() ) );
+#else
+  connect( timer, &QTimer::timeout, reply, &QNetworkReply::abort );
+  connect( reply, &QNetworkReply::finished, timer, &QTimer::stop );
+#endif
+  timer->start( reqtimeout );
+  QgsDebugMsg( QStringLiteral( "Token request timeout set to %1 ms for authcfg: %2" ).arg( reqtimeout ).arg( mAuthcfg ) );
+}
@@ -17,7 +17,14 @@
 
 #include "o2.h"
 
+#include <QMutex>
+#include <QPointer>
+
+class O0AbstractStore;
 class QgsAuthOAuth2Config;
+class QgsNetworkAccessManager;
+class QgsO2TokenCommitter;
+class QgsO2TokenStore;
 
 /**
  * QGIS-specific subclass of O2 lib's base OAuth 2.0 authenticator.
@@ -36,21 +43,84 @@ class QgsO2: public O2
 
     QString authcfg() const { return mAuthcfg; }
     QgsAuthOAuth2Config *oauth2config() { return mOAuth2Config; }
+    QString tokenCacheFile() const { return mTokenCacheFile; }
+
+    //! In-memory token state, written through to the token cache file or database
+    QgsO2TokenStore *tokenStore() const { return mTokenStore; }
+
+    //! Whether tokens are cached in the token database, whose path is then tokenCacheFile()
+    bool tokenCacheDatabase() const { return mTokenDatabase; }
+
+    //! Whether tokens are only cached for the session, and so removed along with this authenticator
+    bool temporaryToken() const { return mTemporaryToken; }
+
+    //! Whether a refresh started through requestRefresh() has yet to finish
+    bool isRefreshing() const;
+
+    /**
+     * Move an authcfg's cached tokens between the persistent and temporary token caches.
+     * Cache files are renamed, or where the caches are on different file systems, copied
+     * beside the target and renamed into place; database rows are moved in one transaction.
+     * For an authcfg without a live authenticator, see migrateTokenCache() otherwise.
+     */
+    static bool moveTokenCache( const QString &authcfg, bool persist );
+
+    /**
+     * Move this authenticator's cached tokens to the persistent or temporary token cache,
+     * and persist to it from now on, keeping the token state held in memory, so the
+     * authcfg stays linked. If the cache can not be moved, the tokens held in memory are
+     * written to the new one instead.
+     */
+    bool migrateTokenCache( bool persist );
 
   public slots:
     void clearProperties();
 
+    /**
+     * Start a token refresh, or join the one already underway, so concurrent
+     * callers only ever cause a single round-trip to the token endpoint.
+     * Returns whether a refresh is still underway, i.e. whether a refreshFinished()
+     * signal is yet to come; it may already have been emitted synchronously.
+     */
+    bool requestRefresh();
+
+    //! Link, applying the config's request timeout to calls to the token endpoint until settled
+    void link() override;
+
+  private slots:
+    void onRefreshSettled( QNetworkReply::NetworkError err );
+
+    void onLinkSettled();
+
+    void onRequestCreated( QNetworkReply *reply );
+
   private:
+    bool isTokenRequest( const QNetworkRequest &request ) const;
+
+    //! Whether to receive the replies created by the network manager, i.e. while linking or refreshing
+    void watchTokenRequests( bool watch );
+
     void initOAuthConfig();
 
     void setSettingsStore( bool persist = false );
 
+    //! Store and committer of the token cache for mTemporaryToken, also setting mTokenCacheFile
+    O0AbstractStore *createTokenBackingStore( QgsO2TokenCommitter **committer );
+
     void setVerificationResponseContent();
 
     QString mTokenCacheFile;
     QString mAuthcfg;
     QgsAuthOAuth2Config *mOAuth2Config;
+    QgsO2TokenStore *mTokenStore;
+    bool mTokenDatabase;
+    bool mTemporaryToken;
+
+    bool mRefreshing;
+    bool mLinking;
+    mutable QMutex mRefreshMutex;
 
+    QPointer<QgsNetworkAccessManager> mNetworkManager;
 };
 
 #endif // QGSO2_H
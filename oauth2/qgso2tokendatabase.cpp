@@ -0,0 +1,484 @@
+/***************************************************************************
+    begin                : October 16, 2026
+    copyright            : (C) 2026 by Boundless Spatial, Inc. USA
+    author               : Larry Shaffer
+    email                : lshaffer at boundlessgeo dot com
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgso2tokendatabase.h"
+
+#include "o0globals.h"
+#include "o0simplecrypt.h"
+#include "qgsauthoauth2config.h"
+#include "qgslogger.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThreadStorage>
+#include <QVariant>
+
+
+// Key for token values, derived from the same secret as O2's settings store
+static quint64 tokenCryptKey()
+{
+  QByteArray hash = QCryptographicHash::hash( QByteArray( O2_ENCRYPTION_KEY ), QCryptographicHash::Sha1 );
+  quint64 key = 0;
+  for ( int i = 0; i < 8; ++i )
+  {
+    key = ( key << 8 ) | static_cast<uchar>( hash.at( i ) );
+  }
+  return key;
+}
+
+// Owner of a cache's rows: temporary caches belong to the session, i.e. process, writing them
+static qint64 cacheOwner( bool temporary )
+{
+  return temporary ? QCoreApplication::applicationPid() : 0;
+}
+
+static bool execQuery( QSqlQuery &query )
+{
+  if ( !query.exec() )
+  {
+    QgsDebugMsg( QStringLiteral( "Token database query FAILED: %1" ).arg( query.lastError().text() ) );
+    return false;
+  }
+  return true;
+}
+
+// Paths of the databases whose table this process already made sure of
+static QSet<QString> sPreparedDatabases;
+static QMutex sPreparedDatabasesMutex;
+
+static QAtomicInt sConnectionCount;
+
+static QString nextConnectionName()
+{
+  return QStringLiteral( "oauth2tokens_%1" ).arg( sConnectionCount.fetchAndAddOrdered( 1 ) );
+}
+
+// Open a new connection, creating the database and its table on first use in the process
+static QSqlDatabase openTokenDatabase( const QString &name, const QString &path )
+{
+  bool prepared = false;
+  {
+    QMutexLocker locker( &sPreparedDatabasesMutex );
+    prepared = sPreparedDatabases.contains( path );
+  }
+  // e.g. removed by the user since
+  bool created = !QFile::exists( path );
+  if ( created )
+  {
+    prepared = false;
+    QDir().mkpath( QFileInfo( path ).absolutePath() );
+  }
+
+  QSqlDatabase db = QSqlDatabase::addDatabase( QStringLiteral( "QSQLITE" ), name );
+  db.setDatabaseName( path );
+  // other threads and processes write to the same file
+  db.setConnectOptions( QStringLiteral( "QSQLITE_BUSY_TIMEOUT=5000" ) );
+  if ( !db.open() )
+  {
+    QgsDebugMsg( QStringLiteral( "FAILED to open token database %1: %2" ).arg( path, db.lastError().text() ) );
+    return db;
+  }
+  if ( prepared )
+  {
+    return db;
+  }
+
+  {
+    QSqlQuery query( db );
+    query.prepare( QStringLiteral( "CREATE TABLE IF NOT EXISTS oauth2_tokens ("
+                                   " authcfg TEXT NOT NULL,"
+                                   " temporary INTEGER NOT NULL,"
+                                   " owner INTEGER NOT NULL,"
+                                   " key TEXT NOT NULL,"
+                                   " value TEXT NOT NULL,"
+                                   " updated INTEGER NOT NULL,"
+                                   " PRIMARY KEY ( authcfg, temporary, owner, key ) )" ) );
+    if ( !execQuery( query ) )
+    {
+      query.clear();
+      db.close();
+      return db;
+    }
+  }
+  if ( created )
+  {
+    QFile::setPermissions( path, QFile::ReadOwner | QFile::WriteOwner );
+  }
+
+  QMutexLocker locker( &sPreparedDatabasesMutex );
+  sPreparedDatabases.insert( path );
+  return db;
+}
+
+// Connections kept open by a thread, per database path, removed when the thread finishes
+class ThreadTokenDatabases
+{
+  public:
+    ~ThreadTokenDatabases()
+    {
+      Q_FOREACH ( const QString &name, names )
+      {
+        QSqlDatabase::database( name, false ).close();
+        QSqlDatabase::removeDatabase( name );
+      }
+    }
+
+    QHash<QString, QString> names;
+};
+
+static QThreadStorage<ThreadTokenDatabases *> sThreadDatabases;
+
+/**
+ * Connection to a token database for one operation. Connections may only be used by the
+ * thread that opened them; a long-lived thread keeps its own open for later operations,
+ * while on pool threads, which expire (and whose addresses are reused), one is opened for
+ * the operation and removed once done.
+ */
+class TokenDatabaseConnection
+{
+  public:
+    TokenDatabaseConnection( const QString &path, QgsO2TokenDatabase::ConnectionMode mode );
+
+    ~TokenDatabaseConnection();
+
+    QSqlDatabase database() const { return mDatabase; }
+
+  private:
+    Q_DISABLE_COPY( TokenDatabaseConnection )
+
+    QString mName; // of a connection for this operation only
+    QSqlDatabase mDatabase;
+};
+
+TokenDatabaseConnection::TokenDatabaseConnection( const QString &path, QgsO2TokenDatabase::ConnectionMode mode )
+{
+  if ( mode == QgsO2TokenDatabase::OperationConnection )
+  {
+    mName = nextConnectionName();
+    mDatabase = openTokenDatabase( mName, path );
+    return;
+  }
+
+  if ( !sThreadDatabases.hasLocalData() )
+  {
+    sThreadDatabases.setLocalData( new ThreadTokenDatabases );
+  }
+  QHash<QString, QString> &names = sThreadDatabases.localData()->names;
+  QString name = names.value( path );
+  if ( !name.isEmpty() )
+  {
+    // a connection to a removed file would write to the unlinked file, not a new one
+    if ( QFile::exists( path ) )
+    {
+      mDatabase = QSqlDatabase::database( name, false );
+      if ( mDatabase.isOpen() )
+      {
+        return;
+      }
+      mDatabase = QSqlDatabase();
+    }
+    names.remove( path );
+    QSqlDatabase::database( name, false ).close();
+    QSqlDatabase::removeDatabase( name );
+  }
+
+  name = nextConnectionName();
+  QSqlDatabase db = openTokenDatabase( name, path );
+  if ( !db.isOpen() )
+  {
+    // retried by the next operation
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase( name );
+    return;
+  }
+  names.insert( path, name );
+  mDatabase = db;
+}
+
+TokenDatabaseConnection::~TokenDatabaseConnection()
+{
+  if ( mName.isEmpty() )
+  {
+    return;
+  }
+  // queries of the operation are gone by now; the last handle must be too before removal
+  mDatabase.close();
+  mDatabase = QSqlDatabase();
+  QSqlDatabase::removeDatabase( mName );
+}
+
+
+QgsO2TokenDatabase::QgsO2TokenDatabase( const QString &path, ConnectionMode mode )
+  : mPath( !path.isEmpty() ? path : QgsAuthOAuth2Config::tokenCacheDatabasePath() )
+  , mMode( mode )
+{
+}
+
+bool QgsO2TokenDatabase::isValid() const
+{
+  TokenDatabaseConnection connection( mPath, mMode );
+  return connection.database().isOpen();
+}
+
+QString QgsO2TokenDatabase::value( const QString &authcfg, bool temporary, const QString &key, bool *found ) const
+{
+  QString value;
+  bool res = false;
+
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( db.isOpen() )
+  {
+    QSqlQuery query( db );
+    query.prepare( QStringLiteral( "SELECT value FROM oauth2_tokens WHERE authcfg = ? AND temporary = ? AND owner = ? AND key = ?" ) );
+    query.addBindValue( authcfg );
+    query.addBindValue( temporary ? 1 : 0 );
+    query.addBindValue( cacheOwner( temporary ) );
+    query.addBindValue( key );
+    if ( execQuery( query ) && query.next() )
+    {
+      O0SimpleCrypt crypt( tokenCryptKey() );
+      value = crypt.decryptToString( query.value( 0 ).toString() );
+      res = true;
+    }
+  }
+
+  if ( found ) *found = res;
+  return value;
+}
+
+bool QgsO2TokenDatabase::setValues( const QString &authcfg, bool temporary, const QMap<QString, QString> &values )
+{
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() || !db.transaction() )
+  {
+    return false;
+  }
+
+  O0SimpleCrypt crypt( tokenCryptKey() );
+  qint64 updated = static_cast<qint64>( QDateTime::currentDateTime().toTime_t() );
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "INSERT OR REPLACE INTO oauth2_tokens ( authcfg, temporary, owner, key, value, updated )"
+                                 " VALUES ( ?, ?, ?, ?, ?, ? )" ) );
+  QMap<QString, QString>::const_iterator it = values.constBegin();
+  for ( ; it != values.constEnd(); ++it )
+  {
+    query.addBindValue( authcfg );
+    query.addBindValue( temporary ? 1 : 0 );
+    query.addBindValue( cacheOwner( temporary ) );
+    query.addBindValue( it.key() );
+    QString encrypted = crypt.encryptToString( it.value() );
+    query.addBindValue( encrypted.isNull() ? QStringLiteral( "" ) : encrypted );
+    query.addBindValue( updated );
+    if ( !execQuery( query ) )
+    {
+      db.rollback();
+      return false;
+    }
+  }
+  return db.commit();
+}
+
+bool QgsO2TokenDatabase::hasTokens( const QString &authcfg, bool temporary ) const
+{
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() )
+  {
+    return false;
+  }
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "SELECT 1 FROM oauth2_tokens WHERE authcfg = ? AND temporary = ? AND owner = ? LIMIT 1" ) );
+  query.addBindValue( authcfg );
+  query.addBindValue( temporary ? 1 : 0 );
+  query.addBindValue( cacheOwner( temporary ) );
+  return execQuery( query ) && query.next();
+}
+
+bool QgsO2TokenDatabase::removeTokens( const QString &authcfg, bool temporary )
+{
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() )
+  {
+    return false;
+  }
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "DELETE FROM oauth2_tokens WHERE authcfg = ? AND temporary = ? AND owner = ?" ) );
+  query.addBindValue( authcfg );
+  query.addBindValue( temporary ? 1 : 0 );
+  query.addBindValue( cacheOwner( temporary ) );
+  return execQuery( query );
+}
+
+bool QgsO2TokenDatabase::moveTokens( const QString &authcfg, bool totemporary )
+{
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() || !db.transaction() )
+  {
+    return false;
+  }
+
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "DELETE FROM oauth2_tokens WHERE authcfg = ? AND temporary = ? AND owner = ?" ) );
+  query.addBindValue( authcfg );
+  query.addBindValue( totemporary ? 1 : 0 );
+  query.addBindValue( cacheOwner( totemporary ) );
+  if ( !execQuery( query ) )
+  {
+    db.rollback();
+    return false;
+  }
+
+  query.prepare( QStringLiteral( "UPDATE oauth2_tokens SET temporary = ?, owner = ?"
+                                 " WHERE authcfg = ? AND temporary = ? AND owner = ?" ) );
+  query.addBindValue( totemporary ? 1 : 0 );
+  query.addBindValue( cacheOwner( totemporary ) );
+  query.addBindValue( authcfg );
+  query.addBindValue( totemporary ? 0 : 1 );
+  query.addBindValue( cacheOwner( !totemporary ) );
+  if ( !execQuery( query ) )
+  {
+    db.rollback();
+    return false;
+  }
+  return db.commit();
+}
+
+bool QgsO2TokenDatabase::removeTemporaryTokens()
+{
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() )
+  {
+    return false;
+  }
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "DELETE FROM oauth2_tokens WHERE temporary = 1 AND owner = ?" ) );
+  query.addBindValue( cacheOwner( true ) );
+  return execQuery( query );
+}
+
+bool QgsO2TokenDatabase::removeTemporaryTokens( const QString &authcfg, qint64 owner )
+{
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() )
+  {
+    return false;
+  }
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "DELETE FROM oauth2_tokens WHERE authcfg = ? AND temporary = 1 AND owner = ?" ) );
+  query.addBindValue( authcfg );
+  query.addBindValue( owner );
+  return execQuery( query );
+}
+
+QList< QPair<QString, qint64> > QgsO2TokenDatabase::temporaryCacheOwners() const
+{
+  QList< QPair<QString, qint64> > owners;
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() )
+  {
+    return owners;
+  }
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "SELECT DISTINCT authcfg, owner FROM oauth2_tokens WHERE temporary = 1" ) );
+  if ( execQuery( query ) )
+  {
+    while ( query.next() )
+    {
+      owners << qMakePair( query.value( 0 ).toString(), query.value( 1 ).toLongLong() );
+    }
+  }
+  return owners;
+}
+
+QStringList QgsO2TokenDatabase::authcfgs( bool temporary ) const
+{
+  QStringList authcfgs;
+  TokenDatabaseConnection connection( mPath, mMode );
+  QSqlDatabase db = connection.database();
+  if ( !db.isOpen() )
+  {
+    return authcfgs;
+  }
+  QSqlQuery query( db );
+  query.prepare( QStringLiteral( "SELECT DISTINCT authcfg FROM oauth2_tokens WHERE temporary = ? AND owner = ?" ) );
+  query.addBindValue( temporary ? 1 : 0 );
+  query.addBindValue( cacheOwner( temporary ) );
+  if ( execQuery( query ) )
+  {
+    while ( query.next() )
+    {
+      authcfgs << query.value( 0 ).toString();
+    }
+  }
+  return authcfgs;
+}
+
+
+QgsO2DatabaseStore::QgsO2DatabaseStore( const QString &authcfg, bool temporary,
+                                        const QString &databasepath, QObject *parent )
+  : O0AbstractStore( parent )
+  , mAuthcfg( authcfg )
+  , mTemporary( temporary )
+  , mDatabase( databasepath )
+{
+}
+
+QString QgsO2DatabaseStore::value( const QString &key, const QString &defaultValue )
+{
+  bool found = false;
+  QString value = mDatabase.value( mAuthcfg, mTemporary, key, &found );
+  return found ? value : defaultValue;
+}
+
+void QgsO2DatabaseStore::setValue( const QString &key, const QString &value )
+{
+  QMap<QString, QString> values;
+  values.insert( key, value );
+  if ( !mDatabase.setValues( mAuthcfg, mTemporary, values ) )
+  {
+    QgsDebugMsg( QStringLiteral( "FAILED to store token value for authcfg %1: %2" ).arg( mAuthcfg, key ) );
+  }
+}
+
+
+QgsO2DatabaseCommitter::QgsO2DatabaseCommitter( const QString &authcfg, bool temporary, const QString &databasepath )
+  : mAuthcfg( authcfg )
+  , mTemporary( temporary )
+  , mDatabase( databasepath, QgsO2TokenDatabase::OperationConnection )
+{
+}
+
+bool QgsO2DatabaseCommitter::commit( const QMap<QString, QString> &values )
+{
+  // the pool thread gets a connection for this commit only
+  return mDatabase.setValues( mAuthcfg, mTemporary, values );
+}
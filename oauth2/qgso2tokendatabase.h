@@ -0,0 +1,123 @@
+/***************************************************************************
+    begin                : October 16, 2026
+    copyright            : (C) 2026 by Boundless Spatial, Inc. USA
+    author               : Larry Shaffer
+    email                : lshaffer at boundlessgeo dot com
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSO2TOKENDATABASE_H
+#define QGSO2TOKENDATABASE_H
+
+#include "o0abstractstore.h"
+#include "qgso2tokenstore.h"
+
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+
+/**
+ * Token caches of all authcfgs in one SQLite database, instead of a settings file per authcfg.
+ *
+ * Rows are keyed by authcfg, whether the cache is temporary (i.e. dropped at the end of the
+ * session), the owning process of temporary caches and O2's store key, with values encrypted
+ * as in the settings files. Temporary caches read and written are this session's. QtSql
+ * connections only work in the thread that opened them, so each thread gets its own.
+ */
+class QgsO2TokenDatabase
+{
+  public:
+    //! How operations connect to the database
+    enum ConnectionMode
+    {
+      ThreadConnection,   //!< Reuse a connection kept open by the calling thread until it finishes
+      OperationConnection //!< Open a connection per operation, e.g. on pool threads, which expire
+    };
+
+    //! Construct for a database file, by default QgsAuthOAuth2Config::tokenCacheDatabasePath()
+    explicit QgsO2TokenDatabase( const QString &path = QString::null, ConnectionMode mode = ThreadConnection );
+
+    QString path() const { return mPath; }
+
+    //! Whether the database could be opened, and its table created if needed
+    bool isValid() const;
+
+    //! Value of one of an authcfg's tokens
+    QString value( const QString &authcfg, bool temporary, const QString &key, bool *found = nullptr ) const;
+
+    //! Store values of an authcfg's tokens in one transaction
+    bool setValues( const QString &authcfg, bool temporary, const QMap<QString, QString> &values );
+
+    //! Whether an authcfg has any stored tokens
+    bool hasTokens( const QString &authcfg, bool temporary ) const;
+
+    //! Remove all of an authcfg's tokens
+    bool removeTokens( const QString &authcfg, bool temporary );
+
+    //! Move an authcfg's tokens between the temporary and persistent caches, replacing any there
+    bool moveTokens( const QString &authcfg, bool totemporary );
+
+    //! Remove the tokens of all authcfgs' temporary caches of this session, e.g. at its end
+    bool removeTemporaryTokens();
+
+    //! Remove an authcfg's tokens from the temporary cache of the session of process \a owner
+    bool removeTemporaryTokens( const QString &authcfg, qint64 owner );
+
+    //! Authcfgs with stored tokens
+    QStringList authcfgs( bool temporary ) const;
+
+    //! Authcfgs and owning processes of the temporary caches of all sessions, e.g. to find orphaned caches
+    QList< QPair<QString, qint64> > temporaryCacheOwners() const;
+
+  private:
+    QString mPath;
+    ConnectionMode mMode;
+};
+
+/**
+ * O2 store backend for one authcfg's token cache in a QgsO2TokenDatabase.
+ * @note Reads go to the database every time, so this is used behind a QgsO2TokenStore.
+ */
+class QgsO2DatabaseStore : public O0AbstractStore
+{
+    Q_OBJECT
+
+  public:
+    QgsO2DatabaseStore( const QString &authcfg, bool temporary,
+                        const QString &databasepath = QString::null, QObject *parent = nullptr );
+
+    QString value( const QString &key, const QString &defaultValue = QString() ) override;
+
+    void setValue( const QString &key, const QString &value ) override;
+
+    QgsO2TokenDatabase database() const { return mDatabase; }
+
+  private:
+    QString mAuthcfg;
+    bool mTemporary;
+    QgsO2TokenDatabase mDatabase;
+};
+
+/**
+ * Commits batches of one authcfg's token values to a QgsO2TokenDatabase in one transaction.
+ */
+class QgsO2DatabaseCommitter : public QgsO2TokenCommitter
+{
+  public:
+    QgsO2DatabaseCommitter( const QString &authcfg, bool temporary, const QString &databasepath = QString::null );
+
+    bool commit( const QMap<QString, QString> &values ) override;
+
+  private:
+    QString mAuthcfg;
+    bool mTemporary;
+    QgsO2TokenDatabase mDatabase;
+};
+
+#endif // QGSO2TOKENDATABASE_H
@@ -0,0 +1,285 @@
+/***************************************************************************
+    begin                : October 16, 2026
+    copyright            : (C) 2026 by Boundless Spatial, Inc. USA
+    author               : Larry Shaffer
+    email                : lshaffer at boundlessgeo dot com
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "qgso2tokenstore.h"
+
+#include "o0globals.h"
+#include "o0settingsstore.h"
+#include "qgslogger.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QtConcurrentRun>
+
+
+QgsO2SettingsCommitter::QgsO2SettingsCommitter( const QString &settingsfile, const QString &groupkey )
+  : mSettingsFile( settingsfile )
+  , mGroupKey( groupkey )
+{
+}
+
+bool QgsO2SettingsCommitter::commit( const QMap<QString, QString> &values )
+{
+  // a settings object of this thread's own, encrypting as the authenticator's store does
+  QSettings settings( mSettingsFile, QSettings::IniFormat );
+  O0SettingsStore store( &settings, O2_ENCRYPTION_KEY );
+  store.setGroupKey( mGroupKey );
+
+  QMap<QString, QString>::const_iterator it = values.constBegin();
+  for ( ; it != values.constEnd(); ++it )
+  {
+    store.setValue( it.key(), it.value() );
+  }
+  settings.sync();
+
+  if ( settings.status() != QSettings::NoError )
+  {
+    QgsDebugMsg( QStringLiteral( "FAILED to write token cache file: %1" ).arg( mSettingsFile ) );
+    return false;
+  }
+  QFile::setPermissions( mSettingsFile, QFile::ReadOwner | QFile::WriteOwner );
+  return true;
+}
+
+
+QgsO2TokenStore::QgsO2TokenStore( O0AbstractStore *backing, QObject *parent )
+  : O0AbstractStore( parent )
+  , mBacking( backing )
+  , mBackingReads( 0 )
+  , mFlushScheduled( false )
+  , mCommitting( false )
+{
+  if ( backing )
+  {
+    backing->setParent( this );
+  }
+}
+
+QgsO2TokenStore::~QgsO2TokenStore()
+{
+  // the pool thread refers to this store until it is done
+  sync();
+}
+
+void QgsO2TokenStore::setCommitter( QgsO2TokenCommitter *committer )
+{
+  // hand over what the previous committer had pending
+  sync();
+  QMutexLocker locker( &mMutex );
+  mCommitter.reset( committer );
+}
+
+void QgsO2TokenStore::setBackingStore( O0AbstractStore *backing, QgsO2TokenCommitter *committer, bool rewrite )
+{
+  sync();
+
+  if ( backing )
+  {
+    // e.g. created by a caller on another thread than this store's
+    if ( backing->thread() != thread() )
+    {
+      backing->moveToThread( thread() );
+    }
+    backing->setParent( this );
+  }
+
+  O0AbstractStore *previous = nullptr;
+  {
+    QMutexLocker locker( &mMutex );
+    previous = mBacking.data();
+    mBacking = backing;
+    mCommitter.reset( committer );
+  }
+  if ( previous && previous != backing )
+  {
+    previous->deleteLater();
+  }
+
+  if ( !rewrite )
+  {
+    return;
+  }
+  QMap<QString, QString> values;
+  {
+    QMutexLocker locker( &mMutex );
+    QHash<QString, QString>::const_iterator it = mValues.constBegin();
+    for ( ; it != mValues.constEnd(); ++it )
+    {
+      // keys known to be missing have nothing to hand over
+      if ( !it.value().isNull() )
+      {
+        values.insert( it.key(), it.value() );
+      }
+    }
+  }
+  QMap<QString, QString>::const_iterator it = values.constBegin();
+  for ( ; it != values.constEnd(); ++it )
+  {
+    if ( committer )
+    {
+      QMutexLocker locker( &mMutex );
+      mPending.insert( it.key(), it.value() );
+    }
+    else if ( backing )
+    {
+      backing->setValue( it.key(), it.value() );
+    }
+  }
+  sync();
+}
+
+QString QgsO2TokenStore::value( const QString &key, const QString &defaultValue )
+{
+  QMutexLocker locker( &mMutex );
+  QHash<QString, QString>::const_iterator it = mValues.constFind( key );
+  if ( it == mValues.constEnd() )
+  {
+    QString stored;
+    if ( mBacking )
+    {
+      // a null default tells values that are missing apart from those that are empty
+      stored = mBacking->value( key, QString() );
+      ++mBackingReads;
+    }
+    it = mValues.insert( key, stored );
+  }
+  return it.value().isNull() ? defaultValue : it.value();
+}
+
+void QgsO2TokenStore::setValue( const QString &key, const QString &value )
+{
+  QMutexLocker locker( &mMutex );
+  QHash<QString, QString>::iterator it = mValues.find( key );
+  // O2 rewrites unchanged values, e.g. on every unlink, so only changes are written through
+  if ( it != mValues.end() && !it.value().isNull() && it.value() == value )
+  {
+    return;
+  }
+
+  // held as empty rather than null, matching what is read back from the backing store
+  mValues.insert( key, value.isNull() ? QStringLiteral( "" ) : value );
+
+  if ( mCommitter )
+  {
+    // the other values of the same token are set in this pass of the event loop,
+    // so committing on the next pass writes them all at once
+    mPending.insert( key, value );
+    if ( !mFlushScheduled )
+    {
+      mFlushScheduled = true;
+      QMetaObject::invokeMethod( this, "flush", Qt::QueuedConnection );
+    }
+  }
+  else if ( mBacking )
+  {
+    mBacking->setValue( key, value );
+  }
+  else
+  {
+    QgsDebugMsg( QStringLiteral( "No backing token store, value held in memory only: %1" ).arg( key ) );
+  }
+}
+
+int QgsO2TokenStore::backingReads() const
+{
+  QMutexLocker locker( &mMutex );
+  return mBackingReads;
+}
+
+bool QgsO2TokenStore::hasPendingWrites() const
+{
+  QMutexLocker locker( &mMutex );
+  return mCommitting || !mPending.isEmpty();
+}
+
+// slot
+void QgsO2TokenStore::reload()
+{
+  // values not yet committed would otherwise be lost, or read back stale
+  sync();
+  QMutexLocker locker( &mMutex );
+  mValues.clear();
+}
+
+// slot
+void QgsO2TokenStore::sync()
+{
+  QMutexLocker locker( &mMutex );
+  while ( mCommitting )
+  {
+    mCommitted.wait( &mMutex );
+  }
+  if ( mPending.isEmpty() || !mCommitter )
+  {
+    return;
+  }
+
+  // no commit is running, so this thread can commit the rest itself
+  mCommitting = true;
+  locker.unlock();
+  commitPending();
+}
+
+// private slot
+void QgsO2TokenStore::flush()
+{
+  QMutexLocker locker( &mMutex );
+  mFlushScheduled = false;
+  // a commit that is running picks up what is pending before it finishes
+  if ( mCommitting || mPending.isEmpty() || !mCommitter )
+  {
+    return;
+  }
+  mCommitting = true;
+  QtConcurrent::run( this, &QgsO2TokenStore::commitPending );
+}
+
+void QgsO2TokenStore::commitPending()
+{
+  Q_FOREVER
+  {
+    QMap<QString, QString> batch;
+    {
+      QMutexLocker locker( &mMutex );
+      if ( mPending.isEmpty() )
+      {
+        mCommitting = false;
+        mCommitted.wakeAll();
+        return;
+      }
+      batch.swap( mPending );
+    }
+
+    // committers only touch their own state, so run unlocked
+    if ( !mCommitter->commit( batch ) )
+    {
+      QgsDebugMsg( QStringLiteral( "FAILED to commit %1 token values; retrying on the next flush or sync" ).arg( batch.size() ) );
+
+      QMutexLocker locker( &mMutex );
+      // values set since the batch was taken are newer than the failed ones
+      QMap<QString, QString>::const_iterator it = batch.constBegin();
+      for ( ; it != batch.constEnd(); ++it )
+      {
+        if ( !mPending.contains( it.key() ) )
+        {
+          mPending.insert( it.key(), it.value() );
+        }
+      }
+      mCommitting = false;
+      mCommitted.wakeAll();
+      return;
+    }
+  }
+}
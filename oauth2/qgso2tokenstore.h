@@ -0,0 +1,131 @@
+/***************************************************************************
+    begin                : October 16, 2026
+    copyright            : (C) 2026 by Boundless Spatial, Inc. USA
+    author               : Larry Shaffer
+    email                : lshaffer at boundlessgeo dot com
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef QGSO2TOKENSTORE_H
+#define QGSO2TOKENSTORE_H
+
+#include "o0abstractstore.h"
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QPointer>
+#include <QScopedPointer>
+#include <QWaitCondition>
+
+/**
+ * Commits batches of token values to where a token store persists them, all or none.
+ * Runs on a background thread, so it must not share state with the store's thread.
+ */
+class QgsO2TokenCommitter
+{
+  public:
+    virtual ~QgsO2TokenCommitter() {}
+
+    //! Persist values in one atomic write; returns whether they were written
+    virtual bool commit( const QMap<QString, QString> &values ) = 0;
+};
+
+/**
+ * Commits token values to an encrypted settings file with a single sync, which Qt writes
+ * to a temporary file that is flushed to disk and renamed over the cache file.
+ */
+class QgsO2SettingsCommitter : public QgsO2TokenCommitter
+{
+  public:
+    QgsO2SettingsCommitter( const QString &settingsfile, const QString &groupkey );
+
+    bool commit( const QMap<QString, QString> &values ) override;
+
+  private:
+    QString mSettingsFile;
+    QString mGroupKey;
+};
+
+/**
+ * Token store that keeps the authoritative, decrypted token state of one authenticator
+ * in memory, in front of a backing store (e.g. an encrypted settings file).
+ *
+ * O2 reads the token, its expiry and the extra tokens through its store on every accessor.
+ * Here each value is read from the backing store once, then served from memory.
+ *
+ * Without a committer, changes are written through to the backing store straight away.
+ * With one, they are written behind: changes made in one pass of the event loop, e.g. all
+ * values of a linked or refreshed token, are committed together on a background thread.
+ */
+class QgsO2TokenStore : public O0AbstractStore
+{
+    Q_OBJECT
+
+  public:
+    //! Construct in front of a backing store, which is reparented to this store
+    explicit QgsO2TokenStore( O0AbstractStore *backing, QObject *parent = nullptr );
+
+    //! Commits values still pending, blocking until they are written
+    ~QgsO2TokenStore();
+
+    QString value( const QString &key, const QString &defaultValue = QString() ) override;
+
+    void setValue( const QString &key, const QString &value ) override;
+
+    //! Store values are persisted to, or nullptr if it has been deleted
+    O0AbstractStore *backingStore() const { return mBacking.data(); }
+
+    //! Write changes behind through a committer, which this store takes ownership of
+    void setCommitter( QgsO2TokenCommitter *committer );
+
+    /**
+     * Persist to another backing store and committer from now on, e.g. after the token cache
+     * has moved between the persistent and temporary caches. Pending changes are committed
+     * to the previous one first. Values held in memory are kept, or with \a rewrite also
+     * written to the new backing store, e.g. when the cache could not be moved.
+     */
+    void setBackingStore( O0AbstractStore *backing, QgsO2TokenCommitter *committer = nullptr, bool rewrite = false );
+
+    //! Number of values read from the backing store, e.g. to verify values are served from memory
+    int backingReads() const;
+
+    //! Whether changes are waiting to be, or being, committed, including ones whose commit failed
+    bool hasPendingWrites() const;
+
+  public slots:
+    //! Forget values held in memory, so they are read again, e.g. after the backing file is replaced
+    void reload();
+
+    //! Commit pending changes now, blocking until all are written
+    void sync();
+
+  private slots:
+    void flush();
+
+  private:
+    // runs on a pool thread until no changes are pending, or a commit fails and its batch is kept pending
+    void commitPending();
+
+    QPointer<O0AbstractStore> mBacking;
+    QScopedPointer<QgsO2TokenCommitter> mCommitter;
+
+    // null strings mark keys known to be missing from the backing store
+    QHash<QString, QString> mValues;
+    int mBackingReads;
+
+    // changes not yet handed to the committer, latest value per key
+    QMap<QString, QString> mPending;
+    bool mFlushScheduled;
+    bool mCommitting;
+    QWaitCondition mCommitted;
+    mutable QMutex mMutex;
+};
+
+#endif // QGSO2TOKENSTORE_H
@@ -21,6 +21,8 @@
 
 #include "Json.h"
 
+#include <climits>
+
 // Qt version specific includes
 #if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
 #include <QJsonDocument>
@@ -32,6 +34,377 @@
 #include <qjson/serializer.h>
 #endif
 
+namespace
+{
+
+  // Nesting below top-level members, past which text is rejected rather than recursed into
+  const int MAX_NESTING = 512;
+
+  // Pull reader of UTF-8 JSON text, for parseJsonObject(). Values are converted as with
+  // parseJson(), or only checked and skipped when no output is given.
+  class JsonReader
+  {
+    public:
+      explicit JsonReader( const QByteArray &data )
+        : mBegin( data.constData() )
+        , mPos( data.constData() )
+        , mEnd( data.constData() + data.size() )
+      {}
+
+      QByteArray errorString() const { return mError; }
+
+      bool fail( const char *message )
+      {
+        if ( mError.isEmpty() )
+        {
+          mError = QByteArray( message ) + " at offset " + QByteArray::number( static_cast<qlonglong>( mPos - mBegin ) );
+        }
+        return false;
+      }
+
+      bool atEnd()
+      {
+        skipSpace();
+        return mPos >= mEnd;
+      }
+
+      bool consume( char c )
+      {
+        skipSpace();
+        if ( mPos < mEnd && *mPos == c )
+        {
+          ++mPos;
+          return true;
+        }
+        return false;
+      }
+
+      bool readString( QString *out )
+      {
+        skipSpace();
+        if ( mPos >= mEnd || *mPos != '"' )
+        {
+          return fail( "expected string" );
+        }
+        ++mPos;
+
+        // unescaped runs are converted in one go
+        QString result;
+        const char *run = mPos;
+        while ( mPos < mEnd )
+        {
+          char c = *mPos;
+          if ( c == '"' )
+          {
+            if ( out )
+            {
+              result += QString::fromUtf8( run, static_cast<int>( mPos - run ) );
+              *out = result;
+            }
+            ++mPos;
+            return true;
+          }
+          if ( static_cast<uchar>( c ) < 0x20 )
+          {
+            return fail( "control character in string" );
+          }
+          if ( c != '\\' )
+          {
+            ++mPos;
+            continue;
+          }
+
+          if ( out )
+          {
+            result += QString::fromUtf8( run, static_cast<int>( mPos - run ) );
+          }
+          if ( ++mPos >= mEnd )
+          {
+            break;
+          }
+          c = *mPos++;
+          QChar escaped;
+          switch ( c )
+          {
+            case '"':
+            case '\\':
+            case '/':
+              escaped = QLatin1Char( c );
+              break;
+            case 'b':
+              escaped = QLatin1Char( '\b' );
+              break;
+            case 'f':
+              escaped = QLatin1Char( '\f' );
+              break;
+            case 'n':
+              escaped = QLatin1Char( '\n' );
+              break;
+            case 'r':
+              escaped = QLatin1Char( '\r' );
+              break;
+            case 't':
+              escaped = QLatin1Char( '\t' );
+              break;
+            case 'u':
+            {
+              // surrogate pairs arrive as two escapes, which is what QString holds anyway
+              ushort code = 0;
+              if ( !readHex4( &code ) )
+              {
+                return false;
+              }
+              escaped = QChar( code );
+              break;
+            }
+            default:
+              return fail( "invalid escape in string" );
+          }
+          if ( out )
+          {
+            result += escaped;
+          }
+          run = mPos;
+        }
+        return fail( "unterminated string" );
+      }
+
+      bool readValue( QVariant *out, int depth )
+      {
+        skipSpace();
+        if ( mPos >= mEnd )
+        {
+          return fail( "expected value" );
+        }
+        if ( depth > MAX_NESTING )
+        {
+          return fail( "nesting too deep" );
+        }
+
+        switch ( *mPos )
+        {
+          case '{':
+            return readObject( out, depth );
+          case '[':
+            return readArray( out, depth );
+          case '"':
+          {
+            QString str;
+            if ( !readString( out ? &str : 0 ) )
+            {
+              return false;
+            }
+            if ( out )
+            {
+              *out = str;
+            }
+            return true;
+          }
+          case 't':
+            return readLiteral( "true", QVariant( true ), out );
+          case 'f':
+            return readLiteral( "false", QVariant( false ), out );
+          case 'n':
+            return readLiteral( "null", QVariant(), out );
+          default:
+            return readNumber( out );
+        }
+      }
+
+    private:
+      void skipSpace()
+      {
+        while ( mPos < mEnd && ( *mPos == ' ' || *mPos == '\n' || *mPos == '\r' || *mPos == '\t' ) )
+        {
+          ++mPos;
+        }
+      }
+
+      bool readHex4( ushort *code )
+      {
+        if ( mEnd - mPos < 4 )
+        {
+          return fail( "truncated unicode escape" );
+        }
+        ushort value = 0;
+        for ( int i = 0; i < 4; ++i )
+        {
+          char c = *mPos++;
+          value <<= 4;
+          if ( c >= '0' && c <= '9' )
+            value |= c - '0';
+          else if ( c >= 'a' && c <= 'f' )
+            value |= c - 'a' + 10;
+          else if ( c >= 'A' && c <= 'F' )
+            value |= c - 'A' + 10;
+          else
+            return fail( "invalid unicode escape" );
+        }
+        *code = value;
+        return true;
+      }
+
+      bool readLiteral( const char *literal, const QVariant &value, QVariant *out )
+      {
+        int len = static_cast<int>( qstrlen( literal ) );
+        if ( mEnd - mPos < len || qstrncmp( mPos, literal, static_cast<uint>( len ) ) != 0 )
+        {
+          return fail( "invalid literal" );
+        }
+        mPos += len;
+        if ( out )
+        {
+          *out = value;
+        }
+        return true;
+      }
+
+      bool readDigits()
+      {
+        const char *start = mPos;
+        while ( mPos < mEnd && *mPos >= '0' && *mPos <= '9' )
+        {
+          ++mPos;
+        }
+        return mPos > start;
+      }
+
+      bool readNumber( QVariant *out )
+      {
+        const char *start = mPos;
+        bool integral = true;
+        if ( *mPos == '-' )
+        {
+          ++mPos;
+        }
+        if ( !readDigits() )
+        {
+          return fail( "invalid value" );
+        }
+        if ( mPos < mEnd && *mPos == '.' )
+        {
+          ++mPos;
+          integral = false;
+          if ( !readDigits() )
+          {
+            return fail( "invalid number" );
+          }
+        }
+        if ( mPos < mEnd && ( *mPos == 'e' || *mPos == 'E' ) )
+        {
+          ++mPos;
+          integral = false;
+          if ( mPos < mEnd && ( *mPos == '+' || *mPos == '-' ) )
+          {
+            ++mPos;
+          }
+          if ( !readDigits() )
+          {
+            return fail( "invalid number" );
+          }
+        }
+        if ( !out )
+        {
+          return true;
+        }
+
+        QByteArray number( start, static_cast<int>( mPos - start ) );
+        bool ok = false;
+        if ( integral )
+        {
+          qlonglong value = number.toLongLong( &ok );
+          if ( ok )
+          {
+            if ( value >= INT_MIN && value <= INT_MAX )
+              *out = static_cast<int>( value );
+            else
+              *out = value;
+            return true;
+          }
+        }
+        *out = number.toDouble( &ok );
+        return ok || fail( "invalid number" );
+      }
+
+      bool readObject( QVariant *out, int depth )
+      {
+        ++mPos;
+        QVariantMap map;
+        if ( !consume( '}' ) )
+        {
+          do
+          {
+            QString key;
+            QVariant value;
+            if ( !readString( out ? &key : 0 ) )
+            {
+              return false;
+            }
+            if ( !consume( ':' ) )
+            {
+              return fail( "expected ':'" );
+            }
+            if ( !readValue( out ? &value : 0, depth + 1 ) )
+            {
+              return false;
+            }
+            if ( out )
+            {
+              map.insert( key, value );
+            }
+          }
+          while ( consume( ',' ) );
+          if ( !consume( '}' ) )
+          {
+            return fail( "expected ',' or '}'" );
+          }
+        }
+        if ( out )
+        {
+          *out = map;
+        }
+        return true;
+      }
+
+      bool readArray( QVariant *out, int depth )
+      {
+        ++mPos;
+        QVariantList list;
+        if ( !consume( ']' ) )
+        {
+          do
+          {
+            QVariant value;
+            if ( !readValue( out ? &value : 0, depth + 1 ) )
+            {
+              return false;
+            }
+            if ( out )
+            {
+              list.append( value );
+            }
+          }
+          while ( consume( ',' ) );
+          if ( !consume( ']' ) )
+          {
+            return fail( "expected ',' or ']'" );
+          }
+        }
+        if ( out )
+        {
+          *out = list;
+        }
+        return true;
+      }
+
+      const char *mBegin;
+      const char *mPos;
+      const char *mEnd;
+      QByteArray mError;
+  };
+
+}
+
 namespace QJsonWrapper
 {
 
@@ -116,6 +489,71 @@ namespace QJsonWrapper
   }
 
 
+  bool
+  parseJsonObject( const QByteArray &jsonData, ObjectHandler *handler, QByteArray *errorString )
+  {
+    JsonReader reader( jsonData );
+    bool res = true;
+
+    if ( !reader.consume( '{' ) )
+    {
+      res = reader.fail( "expected object" );
+    }
+    else if ( !reader.consume( '}' ) )
+    {
+      do
+      {
+        QString key;
+        if ( !reader.readString( &key ) )
+        {
+          res = false;
+          break;
+        }
+        if ( !reader.consume( ':' ) )
+        {
+          res = reader.fail( "expected ':'" );
+          break;
+        }
+        if ( !handler->wantsMember( key ) )
+        {
+          res = reader.readValue( 0, 1 );
+          if ( !res )
+            break;
+          continue;
+        }
+
+        QVariant value;
+        res = reader.readValue( &value, 1 );
+        if ( !res )
+        {
+          break;
+        }
+        if ( !handler->member( key, value ) )
+        {
+          // stopped by the handler
+          return true;
+        }
+      }
+      while ( reader.consume( ',' ) );
+
+      if ( res && !reader.consume( '}' ) )
+      {
+        res = reader.fail( "expected ',' or '}'" );
+      }
+    }
+
+    if ( res && !reader.atEnd() )
+    {
+      res = reader.fail( "unexpected text after object" );
+    }
+    if ( errorString && !res )
+    {
+      *errorString = reader.errorString();
+    }
+    return res;
+  }
+
+
   QByteArray
   toJson( const QVariant &variant, bool *ok, QByteArray *errorString, bool indented )
   {
@@ -56,6 +56,47 @@ namespace QJsonWrapper
    */
   QVariant parseJson( const QByteArray &jsonData, bool *ok = 0, QByteArray *errorString = 0 );
 
+  /**
+   * Receives the top-level members of a JSON object while it is parsed by parseJsonObject().
+   */
+  class ObjectHandler
+  {
+    public:
+      virtual ~ObjectHandler() {}
+
+      /**
+       * Whether the value of a member is wanted. Unwanted values are checked but skipped
+       * without being converted to QVariant.
+       *
+       * @param key The member's key.
+       * @return True to receive the member's value, which is the default.
+       */
+      virtual bool wantsMember( const QString &key ) { Q_UNUSED( key ); return true; }
+
+      /**
+       * Receive the value of a wanted member. Nested objects and arrays are passed
+       * as QVariantMap and QVariantList.
+       *
+       * @param key The member's key.
+       * @param value The member's value.
+       * @return False to stop parsing, e.g. once all needed members are received.
+       */
+      virtual bool member( const QString &key, const QVariant &value ) = 0;
+  };
+
+  /**
+   * Parse a JSON object incrementally, handing each of its members to a handler as it is
+   * read, rather than first building the whole document.
+   *
+   * When the handler stops parsing early, the remaining text is not read, so is not checked.
+   *
+   * @param jsonData The string containing a JSON object.
+   * @param handler Receiver of the object's members.
+   * @param errorString Any error string produced during parsing
+   * @return True if the object was parsed, or parsing was stopped by the handler, without error.
+   */
+  bool parseJsonObject( const QByteArray &jsonData, ObjectHandler *handler, QByteArray *errorString = 0 );
+
   /**
    * Convert a QVariant to a JSON representation.
    *
@@ -20,16 +20,21 @@
 #include <QApplication>
 #include <QDateTime>
 #include <QDebug>
+#include <QFile>
 #include <QObject>
 #include <QString>
 #include <QStringList>
 #include <QTextStream>
 #include <QTemporaryFile>
+#include <QThread>
+#include <QThreadPool>
 
 #include "testutils.h"
 #include "qgsapplication.h"
 #include "qgsauthmanager.h"
 #include "qgsauthoauth2config.h"
+#include "qgsauthoauth2configbundle.h"
+#include "qjsonwrapper/Json.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -79,8 +84,28 @@ class TestQgsAuthOAuth2Config: public QObject
     void testOAuth2Config();
     void testOAuth2ConfigIO();
     void testOAuth2ConfigUtils();
+    void testOAuth2ConfigsCache();
+    void testOAuth2ConfigsParallelLoad();
+    void testOAuth2ConfigDecode();
+    void testOAuth2ConfigBatchUpdate();
+    void testOAuth2ConfigData();
+    void testOAuth2ConfigBinary_data();
+    void testOAuth2ConfigBinary();
+    void testOAuth2ConfigBinaryErrors();
+    void testOAuth2ConfigBundle();
+    void testOAuth2ConfigStreamingParse();
+
+    void benchmarkOAuth2ConfigsLoad_data();
+    void benchmarkOAuth2ConfigsLoad();
+    void benchmarkOAuth2ConfigDecode_data();
+    void benchmarkOAuth2ConfigDecode();
+    void benchmarkOAuth2ConfigSummaries_data();
+    void benchmarkOAuth2ConfigSummaries();
 
   private:
+    QString writeConfigsDir( int count, const QString &prefix );
+    void removeConfigsDir( const QString &dirpath );
+
     QgsAuthOAuth2Config *baseConfig( bool loaded = false );
     QByteArray baseConfigTxt( bool pretty = false );
 
@@ -92,6 +117,33 @@ class TestQgsAuthOAuth2Config: public QObject
     QtMsgHandler mOrigMsgHandler;
 };
 
+// Collects the members of a parsed JSON object, up to an optional last key
+class TestJsonObjectHandler : public QJsonWrapper::ObjectHandler
+{
+  public:
+    explicit TestJsonObjectHandler( const QStringList &wanted = QStringList(), const QString &lastkey = QString() )
+      : mWanted( wanted )
+      , mLastKey( lastkey )
+    {}
+
+    bool wantsMember( const QString &key ) override
+    {
+      return mWanted.isEmpty() || mWanted.contains( key );
+    }
+
+    bool member( const QString &key, const QVariant &value ) override
+    {
+      members.insert( key, value );
+      return key != mLastKey;
+    }
+
+    QVariantMap members;
+
+  private:
+    QStringList mWanted;
+    QString mLastKey;
+};
+
 QString TestQgsAuthOAuth2Config::smHashes = "#####################";
 //QObject *TestQgsAuthOAuth2Config::smParentObj = new QObject();
 
@@ -157,6 +209,7 @@ QgsAuthOAuth2Config *TestQgsAuthOAuth2Config::baseConfig( bool loaded )
     config->setPersistToken( false );
     config->setAccessMethod( QgsAuthOAuth2Config::Header );
     config->setRequestTimeout( 30 ); // in seconds
+    config->setRefreshLeadTime( 300 ); // in seconds
     QVariantMap queryPairs;
     queryPairs.insert( "pf.username", "myusername" );
     queryPairs.insert( "pf.password", "mypassword" );
@@ -190,6 +243,7 @@ QByteArray TestQgsAuthOAuth2Config::baseConfigTxt( bool pretty )
            " },\n"
            " \"redirectPort\" : 7777,\n"
            " \"redirectUrl\" : \"subdir\",\n"
+           " \"refreshLeadTime\" : 300,\n"
            " \"refreshTokenUrl\" : \"https://refreshtoken.oauth2.test\",\n"
            " \"requestTimeout\" : 30,\n"
            " \"requestUrl\" : \"https://request.oauth2.test\",\n"
@@ -219,6 +273,7 @@ QByteArray TestQgsAuthOAuth2Config::baseConfigTxt( bool pretty )
            "    },\n"
            "    \"redirectPort\": 7777,\n"
            "    \"redirectUrl\": \"subdir\",\n"
+           "    \"refreshLeadTime\": 300,\n"
            "    \"refreshTokenUrl\": \"https://refreshtoken.oauth2.test\",\n"
            "    \"requestTimeout\": 30,\n"
            "    \"requestUrl\": \"https://request.oauth2.test\",\n"
@@ -249,6 +304,7 @@ QByteArray TestQgsAuthOAuth2Config::baseConfigTxt( bool pretty )
            "\"queryPairs\":{\"pf.password\":\"mypassword\",\"pf.username\":\"myusername\"},"
            "\"redirectPort\":7777,"
            "\"redirectUrl\":\"subdir\","
+           "\"refreshLeadTime\":300,"
            "\"refreshTokenUrl\":\"https://refreshtoken.oauth2.test\","
            "\"requestTimeout\":30,"
            "\"requestUrl\":\"https://request.oauth2.test\","
@@ -284,6 +340,7 @@ QVariantMap TestQgsAuthOAuth2Config::baseVariantMap()
   vmap.insert( "queryPairs", qpairs );
   vmap.insert( "redirectPort", 7777 );
   vmap.insert( "redirectUrl", "subdir" );
+  vmap.insert( "refreshLeadTime", 300 );
   vmap.insert( "refreshTokenUrl", "https://refreshtoken.oauth2.test" );
   vmap.insert( "requestTimeout", 30 );
   vmap.insert( "requestUrl", "https://request.oauth2.test" );
@@ -482,5 +539,652 @@ void TestQgsAuthOAuth2Config::testOAuth2ConfigUtils()
 
 }
 
+void TestQgsAuthOAuth2Config::testOAuth2ConfigsCache()
+{
+  QString rndsuffix = QgsAuthManager::instance()->uniqueConfigId();
+  QString dirname = QString( "oauth2_configs_cache_%1" ).arg( rndsuffix );
+  QDir tmpdir = QDir::temp();
+  tmpdir.mkdir( dirname );
+  QString dirpath( QDir::tempPath() + "/" + dirname );
+
+  qDebug() << "Verify defined configs are mapped from an extra directory";
+  QgsAuthOAuth2Config *config1 = baseConfig( true );
+  config1->setId( "cacheid1" );
+  QVERIFY( QgsAuthOAuth2Config::writeOAuth2Config( dirpath + "/config1.json", config1,
+           QgsAuthOAuth2Config::JSON, true ) );
+  QMap<QString, QgsAuthOAuth2ConfigData> configs = QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath );
+  QVERIFY( configs.contains( "cacheid1" ) );
+  QVERIFY( !configs.contains( "cacheid2" ) );
+
+  qDebug() << "Verify mapped configs hold decoded values that load without reparsing";
+  QCOMPARE( configs.value( "cacheid1" ).name(), QString( "MyConfig" ) );
+  QVERIFY( configs.value( "cacheid1" ) == config1->data() );
+  QgsAuthOAuth2Config *config1loaded = new QgsAuthOAuth2Config( qApp );
+  config1loaded->setData( configs.value( "cacheid1" ) );
+  QVERIFY( *config1loaded == *config1 );
+  QVERIFY( config1loaded->isValid() );
+
+  qDebug() << "Verify mapping a directory to raw config text";
+  bool ok = false;
+  QgsStringMap configtxts = QgsAuthOAuth2Config::mapOAuth2Configs( dirpath, qApp, QgsAuthOAuth2Config::JSON, &ok );
+  QVERIFY( ok );
+  QCOMPARE( configtxts.keys(), QStringList() << "cacheid1" );
+
+  qDebug() << "Verify a repeated lookup gives the same configs";
+  QCOMPARE( QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath ), configs );
+
+  qDebug() << "Verify writing a config refreshes its directory";
+  QgsAuthOAuth2Config *config2 = baseConfig( true );
+  config2->setId( "cacheid2" );
+  QVERIFY( QgsAuthOAuth2Config::writeOAuth2Config( dirpath + "/config2.json", config2,
+           QgsAuthOAuth2Config::JSON, true ) );
+  configs = QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath );
+  QVERIFY( configs.contains( "cacheid1" ) );
+  QVERIFY( configs.contains( "cacheid2" ) );
+
+  qDebug() << "Verify a config edited in place is noticed, though its directory is unchanged";
+  // a cached directory is only trusted once older than the file system's time resolution
+  QTest::qWait( 2100 );
+  QCOMPARE( QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath ).value( "cacheid2" ).name(), QString( "MyConfig" ) );
+  config2->setName( "EditedConfig" );
+  QFile config2file( dirpath + "/config2.json" );
+  QVERIFY( config2file.open( QIODevice::WriteOnly | QIODevice::Truncate ) );
+  config2file.write( config2->saveConfigTxt( QgsAuthOAuth2Config::JSON, true ) );
+  config2file.close();
+  QCOMPARE( QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath ).value( "cacheid2" ).name(), QString( "EditedConfig" ) );
+
+  qDebug() << "Verify removing a config file is noticed";
+  QVERIFY( QFile::remove( dirpath + "/config1.json" ) );
+  QgsAuthOAuth2Config::invalidateMappedOAuth2ConfigsCache( dirpath );
+  configs = QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath );
+  QVERIFY( !configs.contains( "cacheid1" ) );
+  QVERIFY( configs.contains( "cacheid2" ) );
+
+  QVERIFY( QFile::remove( dirpath + "/config2.json" ) );
+  tmpdir.rmdir( dirname );
+}
+
+QString TestQgsAuthOAuth2Config::writeConfigsDir( int count, const QString &prefix )
+{
+  QString dirname = QString( "%1_%2" ).arg( prefix, QgsAuthManager::instance()->uniqueConfigId() );
+  QDir tmpdir = QDir::temp();
+  tmpdir.mkdir( dirname );
+  QString dirpath( QDir::tempPath() + "/" + dirname );
+
+  QgsAuthOAuth2Config *config = baseConfig( true );
+  for ( int i = 0; i < count; ++i )
+  {
+    config->setId( QString( "id%1" ).arg( i, 4, 10, QChar( '0' ) ) );
+    config->setName( QString( "Config %1" ).arg( i ) );
+    QgsAuthOAuth2Config::writeOAuth2Config( QString( "%1/config%2.json" ).arg( dirpath ).arg( i, 4, 10, QChar( '0' ) ),
+                                            config, QgsAuthOAuth2Config::JSON, true );
+  }
+  delete config;
+  return dirpath;
+}
+
+void TestQgsAuthOAuth2Config::removeConfigsDir( const QString &dirpath )
+{
+  QDir dir( dirpath );
+  Q_FOREACH ( const QString &f, dir.entryList( QDir::Files ) )
+  {
+    dir.remove( f );
+  }
+  QDir::temp().rmdir( QFileInfo( dirpath ).fileName() );
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigsParallelLoad()
+{
+  QString dirpath = writeConfigsDir( 40, "oauth2_configs_parallel" );
+
+  // a later file (in name order) with the same ID overrides an earlier one
+  QgsAuthOAuth2Config *dupe = baseConfig( true );
+  dupe->setId( "id0003" );
+  dupe->setName( "Override" );
+  QVERIFY( QgsAuthOAuth2Config::writeOAuth2Config( dirpath + "/config9999.json", dupe,
+           QgsAuthOAuth2Config::JSON, true ) );
+  delete dupe;
+
+  qDebug() << "Verify concurrent loading matches sequential loading";
+  int maxthreads = QThreadPool::globalInstance()->maxThreadCount();
+  QThreadPool::globalInstance()->setMaxThreadCount( 1 );
+  bool ok = false;
+  QMap<QString, QgsAuthOAuth2ConfigData> sequential = QgsAuthOAuth2Config::mapOAuth2ConfigData( dirpath, QgsAuthOAuth2Config::JSON, &ok );
+  QVERIFY( ok );
+  QThreadPool::globalInstance()->setMaxThreadCount( qMax( 4, maxthreads ) );
+  for ( int run = 0; run < 5; ++run )
+  {
+    QMap<QString, QgsAuthOAuth2ConfigData> concurrent = QgsAuthOAuth2Config::mapOAuth2ConfigData( dirpath, QgsAuthOAuth2Config::JSON, &ok );
+    QVERIFY( ok );
+    QCOMPARE( concurrent, sequential );
+  }
+  QThreadPool::globalInstance()->setMaxThreadCount( maxthreads );
+
+  QCOMPARE( sequential.size(), 40 );
+  QCOMPARE( sequential.value( "id0003" ).name(), QString( "Override" ) );
+
+  qDebug() << "Verify loading objects keeps file name order";
+  QList<QgsAuthOAuth2Config *> configs = QgsAuthOAuth2Config::loadOAuth2Configs( dirpath, nullptr, QgsAuthOAuth2Config::JSON, &ok );
+  QVERIFY( ok );
+  QCOMPARE( configs.size(), 41 );
+  QCOMPARE( configs.first()->id(), QString( "id0000" ) );
+  QCOMPARE( configs.last()->name(), QString( "Override" ) );
+  qDeleteAll( configs );
+
+  removeConfigsDir( dirpath );
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigDecode()
+{
+  qDebug() << "Verify decoding matches property-based loading";
+  QVariantMap props = baseVariantMap();
+  QByteArray propstxt = QJsonWrapper::toJson( props );
+  QgsAuthOAuth2Config *reflected = new QgsAuthOAuth2Config( qApp );
+  QJsonWrapper::qvariant2qobject( props, reflected );
+  QgsAuthOAuth2Config *decoded = new QgsAuthOAuth2Config( qApp );
+  QVERIFY( decoded->loadConfigTxt( propstxt ) );
+  QVERIFY( *decoded == *reflected );
+  QCOMPARE( decoded->id(), reflected->id() );
+  QVERIFY( decoded->isValid() );
+
+  qDebug() << "Verify JSON numbers decode to ints and enums";
+  QgsAuthOAuth2Config *fromtxt = new QgsAuthOAuth2Config( qApp );
+  QVERIFY( fromtxt->loadConfigTxt( baseConfigTxt( true ), QgsAuthOAuth2Config::JSON ) );
+  QVERIFY( *fromtxt == *reflected );
+  QCOMPARE( fromtxt->redirectPort(), 7777 );
+  QCOMPARE( fromtxt->grantFlow(), QgsAuthOAuth2Config::AuthCode );
+
+  qDebug() << "Verify signals are emitted once per load";
+  QgsAuthOAuth2Config *config = new QgsAuthOAuth2Config( qApp );
+  QSignalSpy spy_config( config, SIGNAL( configChanged() ) );
+  QSignalSpy spy_valid( config, SIGNAL( validityChanged( bool ) ) );
+  QSignalSpy spy_name( config, SIGNAL( nameChanged( const QString & ) ) );
+  QVERIFY( config->loadConfigTxt( propstxt ) );
+  QCOMPARE( spy_config.count(), 1 );
+  QCOMPARE( spy_valid.count(), 1 );
+  QCOMPARE( spy_name.count(), 0 );
+  QVERIFY( config->isValid() );
+
+  // reloading identical properties changes nothing
+  QVERIFY( config->loadConfigTxt( propstxt ) );
+  QCOMPARE( spy_config.count(), 1 );
+
+  qDebug() << "Verify unknown keys and unconvertible values are skipped";
+  QVariantMap partial;
+  partial.insert( "notAProperty", "whatever" );
+  partial.insert( "redirectPort", QVariantList() << 1 << 2 );
+  partial.insert( "name", "Renamed" );
+  QVERIFY( config->loadConfigTxt( QJsonWrapper::toJson( partial ) ) );
+  QCOMPARE( config->name(), QString( "Renamed" ) );
+  QCOMPARE( config->redirectPort(), 7777 );
+  QCOMPARE( spy_config.count(), 2 );
+
+  delete reflected;
+  delete decoded;
+  delete fromtxt;
+  delete config;
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigBatchUpdate()
+{
+  QgsAuthOAuth2Config *config = baseConfig();
+  QSignalSpy spy_config( config, SIGNAL( configChanged() ) );
+  QSignalSpy spy_valid( config, SIGNAL( validityChanged( bool ) ) );
+  QSignalSpy spy_port( config, SIGNAL( redirectPortChanged( int ) ) );
+
+  qDebug() << "Verify signals and validation are deferred until the batch ends";
+  config->beginUpdate();
+  QVERIFY( config->isUpdating() );
+  config->setRequestUrl( "https://request.oauth2.test" );
+  config->setTokenUrl( "https://token.oauth2.test" );
+  config->setClientId( "myclientid" );
+  config->setClientSecret( "myclientsecret" );
+  config->setRedirectPort( 7777 );
+  QCOMPARE( spy_config.count(), 0 );
+  QCOMPARE( spy_valid.count(), 0 );
+  QCOMPARE( spy_port.count(), 0 );
+  QVERIFY( !config->isValid() );
+  config->endUpdate();
+  QVERIFY( !config->isUpdating() );
+  QCOMPARE( spy_config.count(), 1 );
+  QCOMPARE( spy_valid.count(), 1 );
+  QVERIFY( config->isValid() );
+
+  qDebug() << "Verify nested batches emit once, at the outermost end";
+  {
+    QgsAuthOAuth2ConfigUpdate outer( config );
+    {
+      QgsAuthOAuth2ConfigUpdate inner( config );
+      config->setRedirectPort( 0 );
+    }
+    QCOMPARE( spy_config.count(), 1 );
+    config->setRedirectPort( 8888 );
+  }
+  QCOMPARE( spy_config.count(), 2 );
+  // validity went false and back within the batch, so no change is signalled
+  QCOMPARE( spy_valid.count(), 1 );
+  QCOMPARE( config->redirectPort(), 8888 );
+
+  qDebug() << "Verify an unchanged batch emits nothing";
+  {
+    QgsAuthOAuth2ConfigUpdate update( config );
+    config->setRedirectPort( 8888 );
+  }
+  QCOMPARE( spy_config.count(), 2 );
+
+  qDebug() << "Verify defaults are restored with a single emission";
+  config->setToDefaults();
+  QCOMPARE( spy_config.count(), 3 );
+  QCOMPARE( spy_valid.count(), 2 );
+  QVERIFY( !config->isValid() );
+  QCOMPARE( spy_port.count(), 0 );
+
+  delete config;
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigData()
+{
+  qDebug() << "Verify default values match a default config object";
+  QgsAuthOAuth2ConfigData data;
+  QgsAuthOAuth2Config *config = baseConfig();
+  QVERIFY( data == config->data() );
+  QCOMPARE( data.redirectPort(), 7070 );
+  QCOMPARE( data.requestTimeout(), 30 );
+  QVERIFY( !data.isValid() );
+
+  qDebug() << "Verify values round-trip through mapped properties";
+  QgsAuthOAuth2Config *loaded = baseConfig( true );
+  QVERIFY( data.loadMappedProperties( loaded->mappedProperties() ) );
+  QCOMPARE( data.mappedProperties(), loaded->mappedProperties() );
+  QCOMPARE( data.id(), QString( "abc1234" ) );
+  QVERIFY( data.isValid() );
+  QVERIFY( data.isValid( true ) );
+  QVERIFY( !data.loadMappedProperties( loaded->mappedProperties() ) );
+
+  qDebug() << "Verify copies are independent once changed";
+  QgsAuthOAuth2ConfigData copy( data );
+  QVERIFY( copy == data );
+  copy.setRedirectPort( 0 );
+  QVERIFY( copy != data );
+  QVERIFY( !copy.isValid() );
+  QCOMPARE( data.redirectPort(), 7777 );
+
+  qDebug() << "Verify the config object shares values and emits once when set";
+  QSignalSpy spy_config( config, SIGNAL( configChanged() ) );
+  QSignalSpy spy_valid( config, SIGNAL( validityChanged( bool ) ) );
+  config->setData( data );
+  QCOMPARE( spy_config.count(), 1 );
+  QCOMPARE( spy_valid.count(), 1 );
+  QVERIFY( config->isValid() );
+  QVERIFY( *config == *loaded );
+  config->setData( data );
+  QCOMPARE( spy_config.count(), 1 );
+
+  qDebug() << "Verify changing the object does not change data shared with it";
+  config->setName( "Changed" );
+  QCOMPARE( config->name(), QString( "Changed" ) );
+  QCOMPARE( data.name(), QString( "MyConfig" ) );
+  QCOMPARE( config->data().name(), QString( "Changed" ) );
+
+  delete config;
+  delete loaded;
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigBinary_data()
+{
+  QTest::addColumn<QString>( "samplepath" );
+  QDir samplesdir( QString( OAUTH2_CONFIG_SAMPLES ) + "/QGIS3" );
+  Q_FOREACH ( const QString &sample, samplesdir.entryList( QStringList() << "*.json", QDir::Files ) )
+  {
+    QTest::newRow( sample.toLatin1().constData() ) << samplesdir.filePath( sample );
+  }
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigBinary()
+{
+  QFETCH( QString, samplepath );
+  QFile samplefile( samplepath );
+  QVERIFY( samplefile.open( QIODevice::ReadOnly | QIODevice::Text ) );
+  QByteArray jsontxt = samplefile.readAll();
+  samplefile.close();
+
+  QgsAuthOAuth2ConfigData fromjson;
+  QVERIFY( fromjson.loadSerialized( jsontxt, QgsAuthOAuth2Config::JSON ) );
+  QVERIFY( !fromjson.id().isEmpty() );
+
+  qDebug() << "Verify JSON samples round-trip through the binary format";
+  bool ok = false;
+  QByteArray binary = fromjson.serialized( QgsAuthOAuth2Config::Binary, false, &ok );
+  QVERIFY( ok );
+  QVERIFY( binary.size() < jsontxt.size() );
+  QgsAuthOAuth2ConfigData frombinary;
+  QVERIFY( frombinary.loadSerialized( binary, QgsAuthOAuth2Config::Binary ) );
+  QVERIFY( frombinary == fromjson );
+  QCOMPARE( frombinary.mappedProperties(), fromjson.mappedProperties() );
+  QCOMPARE( frombinary.serialized( QgsAuthOAuth2Config::Binary ), binary );
+
+  qDebug() << "Verify variant conversion of binary configs";
+  QVariantMap props = QgsAuthOAuth2Config::variantFromSerialized( binary, QgsAuthOAuth2Config::Binary, &ok );
+  QVERIFY( ok );
+  QCOMPARE( props, fromjson.mappedProperties() );
+  QCOMPARE( QgsAuthOAuth2Config::serializeFromVariant( props, QgsAuthOAuth2Config::Binary, false, &ok ), binary );
+  QVERIFY( ok );
+
+  qDebug() << "Verify stored config map values of either format";
+  QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::JSON;
+  QString stored = QgsAuthOAuth2Config::storedFromConfigTxt( binary, QgsAuthOAuth2Config::Binary );
+  QCOMPARE( QgsAuthOAuth2Config::configTxtFromStored( stored, &format ), binary );
+  QCOMPARE( format, QgsAuthOAuth2Config::Binary );
+  stored = QgsAuthOAuth2Config::storedFromConfigTxt( jsontxt, QgsAuthOAuth2Config::JSON );
+  QCOMPARE( QgsAuthOAuth2Config::configTxtFromStored( stored, &format ), jsontxt );
+  QCOMPARE( format, QgsAuthOAuth2Config::JSON );
+
+  qDebug() << "Verify config objects load binary configs";
+  QgsAuthOAuth2Config *config = new QgsAuthOAuth2Config( qApp );
+  QVERIFY( config->loadConfigTxt( binary, QgsAuthOAuth2Config::Binary ) );
+  QVERIFY( config->data() == fromjson );
+  QCOMPARE( config->id(), fromjson.id() );
+  QCOMPARE( config->isValid(), fromjson.isValid() );
+  if ( config->isValid() )
+  {
+    QCOMPARE( config->saveConfigTxt( QgsAuthOAuth2Config::Binary, false, &ok ), binary );
+    QVERIFY( ok );
+  }
+  delete config;
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigBinaryErrors()
+{
+  QgsAuthOAuth2Config *config = baseConfig( true );
+  bool ok = false;
+  QByteArray binary = config->saveConfigTxt( QgsAuthOAuth2Config::Binary, false, &ok );
+  QVERIFY( ok );
+
+  qDebug() << "Verify JSON text is not taken for a binary config";
+  QgsAuthOAuth2ConfigData data( config->data() );
+  QVERIFY( !data.loadSerialized( baseConfigTxt(), QgsAuthOAuth2Config::Binary ) );
+  QVERIFY( data == config->data() );
+
+  qDebug() << "Verify truncated binary configs are rejected";
+  QVERIFY( !data.loadSerialized( binary.left( binary.size() - 3 ), QgsAuthOAuth2Config::Binary ) );
+  QVERIFY( !data.loadSerialized( QByteArray(), QgsAuthOAuth2Config::Binary ) );
+
+  qDebug() << "Verify binary configs of an unknown format version are rejected";
+  QByteArray unknown( binary );
+  unknown[4] = static_cast<char>( 0 );
+  QVERIFY( !data.loadSerialized( unknown, QgsAuthOAuth2Config::Binary ) );
+  QgsAuthOAuth2Config::ConfigFormat format = QgsAuthOAuth2Config::Binary;
+  QCOMPARE( QgsAuthOAuth2Config::configTxtFromStored( QString( "not a config" ), &format ), QByteArray( "not a config" ) );
+  QCOMPARE( format, QgsAuthOAuth2Config::JSON );
+
+  QVERIFY( data == config->data() );
+
+  qDebug() << "Verify binary configs of a newer format version load, ignoring values it appended";
+  QByteArray newer( binary );
+  newer[4] = static_cast<char>( 99 );
+  newer.append( QByteArray( "\x00\x00\x00\x2a", 4 ) );
+  QgsAuthOAuth2ConfigData newerdata;
+  QVERIFY( newerdata.loadSerialized( newer, QgsAuthOAuth2Config::Binary ) );
+  QVERIFY( newerdata == config->data() );
+  delete config;
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigBundle()
+{
+  QString dirpath = writeConfigsDir( 20, "oauth2_configs_bundle" );
+  QString bundlepath( dirpath + "/" + QgsAuthOAuth2ConfigBundle::bundleFileName() );
+  bool ok = false;
+  QMap<QString, QgsAuthOAuth2ConfigData> scanned = QgsAuthOAuth2Config::mapOAuth2ConfigData( dirpath, QgsAuthOAuth2Config::JSON, &ok );
+  QVERIFY( ok );
+
+  qDebug() << "Verify compiling a directory to a bundle and looking up its configs";
+  QString error;
+  QVERIFY2( QgsAuthOAuth2ConfigBundle::compileDirectory( dirpath, QString(), QgsAuthOAuth2Config::JSON, &error ),
+            error.toLocal8Bit().constData() );
+  QVERIFY( QFile::exists( bundlepath ) );
+  QVERIFY( !QFile::exists( bundlepath + ".tmp" ) );
+
+  QgsAuthOAuth2ConfigBundle bundle;
+  QVERIFY( bundle.open( bundlepath ) );
+  QVERIFY( bundle.isOpen() );
+  QCOMPARE( bundle.count(), 20 );
+  QStringList ids( bundle.ids() );
+  ids.sort();
+  QCOMPARE( ids, scanned.keys() );
+  QVERIFY( bundle.contains( "id0007" ) );
+  QVERIFY( !bundle.contains( "id0020" ) );
+  QgsAuthOAuth2ConfigData data = bundle.config( "id0007", &ok );
+  QVERIFY( ok );
+  QCOMPARE( data.id(), QString( "id0007" ) );
+  QCOMPARE( data.name(), QString( "Config 7" ) );
+  QVERIFY( data == scanned.value( "id0007" ) );
+  bundle.config( "id0020", &ok );
+  QVERIFY( !ok );
+  QCOMPARE( bundle.configs(), scanned );
+  bundle.close();
+  QVERIFY( !bundle.isOpen() );
+  QCOMPARE( bundle.count(), 0 );
+
+  qDebug() << "Verify corrupt, truncated and newer version bundles are rejected";
+  QFile bundlefile( bundlepath );
+  QVERIFY( bundlefile.open( QIODevice::ReadOnly ) );
+  QByteArray bundlebytes( bundlefile.readAll() );
+  bundlefile.close();
+  // outside the configs directory, so its modification time keeps matching the bundle's
+  QString badpath( QString( "%1/oauth2_bad_%2.bundle" ).arg( QDir::tempPath(), QgsAuthManager::instance()->uniqueConfigId() ) );
+  QList<QByteArray> bad;
+  QByteArray newer( bundlebytes );
+  newer[4] = static_cast<char>( 99 );
+  bad << QByteArray( "not a bundle" ) << bundlebytes.left( bundlebytes.size() - 5 ) << newer;
+  Q_FOREACH ( const QByteArray &badbytes, bad )
+  {
+    QFile badfile( badpath );
+    QVERIFY( badfile.open( QIODevice::WriteOnly | QIODevice::Truncate ) );
+    badfile.write( badbytes );
+    badfile.close();
+    QVERIFY( !bundle.open( badpath ) );
+    QVERIFY( !bundle.isOpen() );
+  }
+  QVERIFY( QFile::remove( badpath ) );
+
+  qDebug() << "Verify the defined configs cache reads from the bundle";
+  QCOMPARE( QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath ).value( "id0007" ), scanned.value( "id0007" ) );
+  data = QgsAuthOAuth2Config::definedOAuth2Config( "id0007", dirpath, &ok );
+  QVERIFY( ok );
+  QVERIFY( data == scanned.value( "id0007" ) );
+  QgsAuthOAuth2Config::definedOAuth2Config( "id0020", dirpath, &ok );
+  QVERIFY( !ok );
+
+  qDebug() << "Verify a config edited in place makes the bundle stale until recompiled";
+  // past the file system's time resolution, so the edit is newer than the bundle
+  QTest::qWait( 1100 );
+  QgsAuthOAuth2Config *config = baseConfig( true );
+  config->setId( "id0007" );
+  config->setName( "Edited" );
+  QVERIFY( QgsAuthOAuth2Config::writeOAuth2Config( dirpath + "/config0007.json", config,
+           QgsAuthOAuth2Config::JSON, true ) );
+  QCOMPARE( QgsAuthOAuth2Config::definedOAuth2Config( "id0007", dirpath ).name(), QString( "Edited" ) );
+  QVERIFY( QgsAuthOAuth2ConfigBundle::compileDirectory( dirpath ) );
+  QgsAuthOAuth2Config::invalidateMappedOAuth2ConfigsCache( dirpath );
+  QCOMPARE( QgsAuthOAuth2Config::definedOAuth2Config( "id0007", dirpath ).name(), QString( "Edited" ) );
+  QCOMPARE( QgsAuthOAuth2Config::mappedOAuth2ConfigsCache( qApp, dirpath ).value( "id0007" ).name(), QString( "Edited" ) );
+  delete config;
+
+  removeConfigsDir( dirpath );
+}
+
+void TestQgsAuthOAuth2Config::testOAuth2ConfigStreamingParse()
+{
+  qDebug() << "Verify streamed JSON samples decode the same as parsed documents";
+  QDir samplesdir( OAUTH2_CONFIG_SAMPLES );
+  QStringList samples( samplesdir.entryList( QStringList() << "*.json", QDir::Files ) );
+  QVERIFY( !samples.isEmpty() );
+  Q_FOREACH ( const QString &sample, samples )
+  {
+    QFile samplefile( samplesdir.filePath( sample ) );
+    QVERIFY( samplefile.open( QIODevice::ReadOnly | QIODevice::Text ) );
+    QByteArray jsontxt = samplefile.readAll();
+    samplefile.close();
+
+    bool ok = false;
+    QgsAuthOAuth2ConfigData parsed;
+    parsed.loadMappedProperties( QJsonWrapper::parseJson( jsontxt, &ok ).toMap() );
+    QVERIFY( ok );
+    QgsAuthOAuth2ConfigData streamed;
+    QVERIFY( streamed.loadSerialized( jsontxt, QgsAuthOAuth2Config::JSON ) );
+    QVERIFY2( streamed == parsed, sample.toLocal8Bit().constData() );
+    QCOMPARE( streamed.id(), parsed.id() );
+  }
+
+  qDebug() << "Verify values and escapes are converted";
+  QByteArray errStr;
+  TestJsonObjectHandler all;
+  QVERIFY( QJsonWrapper::parseJsonObject(
+             "{ \"s\": \"a\\u00e9\\n\\\"b\\ud83d\\ude00\", \"i\": -12, \"big\": 12345678901,"
+             " \"d\": 1.5e2, \"t\": true, \"n\": null, \"l\": [1, \"x\", {}], \"o\": { \"k\": false } }",
+             &all, &errStr ) );
+  QCOMPARE( all.members.value( "s" ).toString(), QString::fromUtf8( "a\xc3\xa9\n\"b\xf0\x9f\x98\x80" ) );
+  QCOMPARE( all.members.value( "i" ).toInt(), -12 );
+  QCOMPARE( all.members.value( "big" ).toLongLong(), Q_INT64_C( 12345678901 ) );
+  QCOMPARE( all.members.value( "d" ).toDouble(), 150.0 );
+  QCOMPARE( all.members.value( "t" ).toBool(), true );
+  QVERIFY( all.members.contains( "n" ) && all.members.value( "n" ).isNull() );
+  QCOMPARE( all.members.value( "l" ).toList().size(), 3 );
+  QCOMPARE( all.members.value( "o" ).toMap().value( "k" ).toBool(), false );
+
+  qDebug() << "Verify unwanted members are skipped and parsing can stop early";
+  TestJsonObjectHandler some( QStringList() << "id" << "name", "name" );
+  QVERIFY( QJsonWrapper::parseJsonObject( "{\"skip\": {\"a\": [1, 2]}, \"id\": \"x\", \"name\": \"y\", \"broken\": }",
+           &some, &errStr ) );
+  QCOMPARE( some.members.keys(), QStringList() << "id" << "name" );
+  TestJsonObjectHandler full;
+  QVERIFY( !QJsonWrapper::parseJsonObject( "{\"id\": \"x\", \"name\": \"y\", \"broken\": }", &full, &errStr ) );
+
+  qDebug() << "Verify invalid text is rejected";
+  QList<QByteArray> invalid;
+  invalid << "" << "[1]" << "{\"a\": 1,}" << "{\"a\": 1} x" << "{\"a\": tru}" << "{\"a\" 1}"
+          << "{\"a\": \"b}" << "{\"a\": \"\\x\"}" << "{\"a\": 1.}" << "{\"a\": [1 2]}";
+  Q_FOREACH ( const QByteArray &txt, invalid )
+  {
+    TestJsonObjectHandler handler;
+    errStr.clear();
+    QVERIFY2( !QJsonWrapper::parseJsonObject( txt, &handler, &errStr ), txt.constData() );
+    QVERIFY( !errStr.isEmpty() );
+  }
+
+  qDebug() << "Verify partial decoding of configs, e.g. for listing";
+  QgsAuthOAuth2Config *config = baseConfig( true );
+  QByteArray configtxt = config->saveConfigTxt( QgsAuthOAuth2Config::JSON );
+  QgsAuthOAuth2ConfigData partial;
+  QVERIFY( partial.loadSerializedKeys( configtxt, QgsAuthOAuth2Config::listingKeys() ) );
+  QCOMPARE( partial.name(), config->name() );
+  QCOMPARE( partial.grantFlow(), config->grantFlow() );
+  QCOMPARE( partial.description(), config->description() );
+  QVERIFY( partial.clientId().isEmpty() );
+  QVERIFY( !config->clientId().isEmpty() );
+  QVERIFY( !partial.loadSerializedKeys( QByteArray( "{}" ), QgsAuthOAuth2Config::listingKeys() ) );
+  delete config;
+
+  QString dirpath = writeConfigsDir( 10, "oauth2_configs_summaries" );
+  bool ok = false;
+  QMap<QString, QgsAuthOAuth2ConfigData> summaries =
+    QgsAuthOAuth2Config::mapOAuth2ConfigSummaries( dirpath, QStringList() << "name", QgsAuthOAuth2Config::JSON, &ok );
+  QVERIFY( ok );
+  QCOMPARE( summaries.size(), 10 );
+  QCOMPARE( summaries.value( "id0004" ).name(), QString( "Config 4" ) );
+  QVERIFY( summaries.value( "id0004" ).clientId().isEmpty() );
+
+  qDebug() << "Verify defined configs are listed from summaries";
+  summaries = QgsAuthOAuth2Config::mappedOAuth2ConfigSummaries( dirpath );
+  QVERIFY( summaries.contains( "id0009" ) );
+  QCOMPARE( summaries.value( "id0004" ).name(), QString( "Config 4" ) );
+  QCOMPARE( summaries.value( "id0004" ).grantFlow(), QgsAuthOAuth2Config::AuthCode );
+  QVERIFY( summaries.value( "id0004" ).clientId().isEmpty() );
+  removeConfigsDir( dirpath );
+}
+
+void TestQgsAuthOAuth2Config::benchmarkOAuth2ConfigsLoad_data()
+{
+  QTest::addColumn<int>( "threads" );
+  QTest::newRow( "sequential" ) << 1;
+  QTest::newRow( "concurrent" ) << QThread::idealThreadCount();
+}
+
+void TestQgsAuthOAuth2Config::benchmarkOAuth2ConfigsLoad()
+{
+  QFETCH( int, threads );
+  QString dirpath = writeConfigsDir( 300, "oauth2_configs_bench" );
+
+  int maxthreads = QThreadPool::globalInstance()->maxThreadCount();
+  QThreadPool::globalInstance()->setMaxThreadCount( threads );
+  QMap<QString, QgsAuthOAuth2ConfigData> configs;
+  QBENCHMARK
+  {
+    configs = QgsAuthOAuth2Config::mapOAuth2ConfigData( dirpath );
+  }
+  QThreadPool::globalInstance()->setMaxThreadCount( maxthreads );
+  QCOMPARE( configs.size(), 300 );
+
+  removeConfigsDir( dirpath );
+}
+
+void TestQgsAuthOAuth2Config::benchmarkOAuth2ConfigDecode_data()
+{
+  QTest::addColumn<bool>( "reflection" );
+  QTest::newRow( "reflection" ) << true;
+  QTest::newRow( "decoder" ) << false;
+}
+
+void TestQgsAuthOAuth2Config::benchmarkOAuth2ConfigDecode()
+{
+  QFETCH( bool, reflection );
+  const int count = 1000;
+  QVariantMap props = baseVariantMap();
+
+  // each iteration loads 1000 configs, so configs/sec = 1000000 / msecs per iteration
+  QBENCHMARK
+  {
+    for ( int i = 0; i < count; ++i )
+    {
+      QgsAuthOAuth2Config config;
+      if ( reflection )
+      {
+        QJsonWrapper::qvariant2qobject( props, &config );
+      }
+      else
+      {
+        QgsAuthOAuth2ConfigData data;
+        data.loadMappedProperties( props );
+        config.setData( data );
+      }
+    }
+  }
+}
+
+void TestQgsAuthOAuth2Config::benchmarkOAuth2ConfigSummaries_data()
+{
+  QTest::addColumn<bool>( "summaries" );
+  QTest::newRow( "full" ) << false;
+  QTest::newRow( "summaries" ) << true;
+}
+
+void TestQgsAuthOAuth2Config::benchmarkOAuth2ConfigSummaries()
+{
+  QFETCH( bool, summaries );
+  QString dirpath = writeConfigsDir( 300, "oauth2_configs_bench" );
+
+  QMap<QString, QgsAuthOAuth2ConfigData> configs;
+  QBENCHMARK
+  {
+    if ( summaries )
+      configs = QgsAuthOAuth2Config::mapOAuth2ConfigSummaries( dirpath );
+    else
+      configs = QgsAuthOAuth2Config::mapOAuth2ConfigData( dirpath );
+  }
+  QCOMPARE( configs.size(), 300 );
+
+  removeConfigsDir( dirpath );
+}
+
 QGSTEST_MAIN( TestQgsAuthOAuth2Config )
 #include "testqgsauthoauth2config.moc"